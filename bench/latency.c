@@ -0,0 +1,397 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+/*
+ * Keystroke latency harness
+ * Runs bin/kilo on a pseudo terminal, writes keys to it and times each key until the frame it caused
+ * has been fully written, which the editor marks by showing the cursor again at the end of every refresh
+ */
+
+/*** defines ***/
+#define FRAME_END "\x1b[?25h"
+#define FRAME_END_LEN 6
+
+#define MAX_KEY_LEN 16
+#define FRAME_TIMEOUT_MS 2000
+#define SETTLE_MS 300
+
+#define CTRL_KEY(k) ((k) & 0x1f)
+
+/*** data ***/
+typedef struct {
+    char bytes[MAX_KEY_LEN];
+    int len;
+} Key;
+
+typedef struct {
+    const char *name;
+    Key *keys;
+    int count, capacity;
+} KeyStream;
+
+typedef struct {
+    double *latency;    /* microseconds, per key */
+    size_t *bytes;      /* output bytes, per key */
+    int count;
+    int timeouts;
+} Result;
+
+static struct {
+    const char *editor;
+    const char *file;
+    const char *keyfile;
+    double rate;        /* keys per second, 0 sends each key once the previous frame is written */
+    int rows, cols;
+    int repeat;
+} O = { "bin/kilo", "src/kilo.c", NULL, 0, 24, 80, 1 };
+
+static struct {
+    int fd;
+    pid_t pid;
+    int matched;        /* bytes of FRAME_END matched at the end of the last read */
+    size_t pending;     /* bytes read since the last frame ended */
+} P;
+
+/*** time ***/
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fail(const char *s) {
+    perror(s);
+    if (P.pid > 0) kill(P.pid, SIGKILL);
+    exit(1);
+}
+
+/*** key streams ***/
+static void streamAdd(KeyStream *ks, const char *bytes, int len) {
+    if (len <= 0 || len > MAX_KEY_LEN) return;
+    if (ks->count == ks->capacity) {
+        ks->capacity = ks->capacity ? 2 * ks->capacity : 64;
+        ks->keys = (Key *) realloc(ks->keys, sizeof(Key) * ks->capacity);
+        if (!ks->keys) fail("realloc");
+    }
+    memcpy(ks->keys[ks->count].bytes, bytes, len);
+    ks->keys[ks->count++].len = len;
+}
+
+static void streamText(KeyStream *ks, const char *text) {
+    for (const char *c = text; *c; c++) streamAdd(ks, c, 1);
+}
+
+static void streamRepeat(KeyStream *ks, const char *key, int n) {
+    for (int i = 0; i < n; i++) streamAdd(ks, key, strlen(key));
+}
+
+/*
+ * Description:
+ * Builds the recorded streams run when no key file is given
+ * They only move, type and undo, so the opened file is never saved
+ */
+static int streamsBuiltin(KeyStream *streams) {
+    const char up[] = "\x1b[A", down[] = "\x1b[B", right[] = "\x1b[C", left[] = "\x1b[D";
+    const char pageUp[] = "\x1b[5~", pageDown[] = "\x1b[6~";
+    const char undo[] = { CTRL_KEY('u'), 0 }, redo[] = { CTRL_KEY('r'), 0 };
+
+    streams[0].name = "move";
+    streamRepeat(&streams[0], down, 100);
+    streamRepeat(&streams[0], right, 40);
+    streamRepeat(&streams[0], up, 100);
+    streamRepeat(&streams[0], left, 40);
+
+    streams[1].name = "page";
+    streamRepeat(&streams[1], pageDown, 20);
+    streamRepeat(&streams[1], pageUp, 20);
+
+    streams[2].name = "type";
+    for (int i = 0; i < 4; i++) streamText(&streams[2], "the quick brown fox jumps over the lazy dog\r");
+
+    streams[3].name = "edit";
+    for (int i = 0; i < 20; i++) {
+        streamText(&streams[3], "word");
+        streamRepeat(&streams[3], "\x7f", 4);
+        streamRepeat(&streams[3], undo, 1);
+        streamRepeat(&streams[3], redo, 1);
+    }
+    return 4;
+}
+
+/*
+ * Description:
+ * Reads a recorded stream, one key per line written with C escapes (\r, \t, \e, \xHH, \\)
+ * Empty lines and lines starting with '#' are skipped
+ */
+static int streamsLoad(KeyStream *streams, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) fail(path);
+
+    streams[0].name = path;
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) linelen--;
+        if (!linelen || line[0] == '#') continue;
+
+        char key[MAX_KEY_LEN];
+        int len = 0;
+        for (ssize_t i = 0; i < linelen && len < MAX_KEY_LEN; i++) {
+            char c = line[i];
+            if (c == '\\' && i + 1 < linelen) {
+                c = line[++i];
+                if (c == 'r') c = '\r';
+                else if (c == 't') c = '\t';
+                else if (c == 'e') c = '\x1b';
+                else if (c == 'x' && i + 2 < linelen) {
+                    char hex[3] = { line[i + 1], line[i + 2], 0 };
+                    c = (char) strtol(hex, NULL, 16);
+                    i += 2;
+                }
+            }
+            key[len++] = c;
+        }
+        streamAdd(&streams[0], key, len);
+    }
+    free(line);
+    fclose(fp);
+    return 1;
+}
+
+/*** pseudo terminal ***/
+static void editorStart(void) {
+    struct winsize ws = { .ws_row = O.rows, .ws_col = O.cols };
+    P.pid = forkpty(&P.fd, NULL, NULL, &ws);
+    if (P.pid == -1) fail("forkpty");
+    if (P.pid == 0) {
+        execl(O.editor, O.editor, O.file, (char *) NULL);
+        perror(O.editor);
+        _exit(127);
+    }
+}
+
+static void editorStop(void) {
+    kill(P.pid, SIGKILL);
+    waitpid(P.pid, NULL, 0);
+    close(P.fd);
+}
+
+/*
+ * Description:
+ * Reads whatever the editor wrote within timeout milliseconds
+ * Returns the number of frames completed, -1 once the editor is gone
+ * The size of each completed frame is stored in frameBytes, which holds at least max entries, when not NULL
+ */
+static int editorRead(int timeout, size_t *frameBytes, int max) {
+    struct pollfd pfd = { .fd = P.fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, timeout);
+    if (ready == -1 && errno != EINTR) fail("poll");
+    if (ready <= 0) return 0;
+
+    char buf[65536];
+    ssize_t n = read(P.fd, buf, sizeof(buf));
+    if (n <= 0) return -1;
+
+    /* the marker may be split over reads, only the matched prefix is carried over */
+    int frames = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        P.pending++;
+        if (buf[i] == FRAME_END[P.matched]) P.matched++;
+        else P.matched = buf[i] == FRAME_END[0];
+
+        if (P.matched == FRAME_END_LEN) {
+            if (frameBytes && frames < max) frameBytes[frames] = P.pending;
+            frames++;
+            P.matched = 0;
+            P.pending = 0;
+        }
+    }
+    return frames;
+}
+
+/* Waits until the editor stayed quiet for SETTLE_MS, so startup and earlier streams do not count */
+static void editorSettle(void) {
+    int frames;
+    P.pending = 0;
+    while ((frames = editorRead(SETTLE_MS, NULL, 0)) != 0 || P.pending) {
+        if (frames == -1) {
+            fprintf(stderr, "%s exited\n", O.editor);
+            exit(1);
+        }
+        P.pending = 0;
+    }
+    P.matched = 0;
+}
+
+/*** measuring ***/
+/*
+ * Description:
+ * Sends the keys of ks and pairs the n-th completed frame with the n-th key,
+ * the editor refreshes once per key it processes
+ * With a rate keys are sent on schedule even if frames lag behind, otherwise one after another
+ */
+static void measure(const KeyStream *ks, Result *res) {
+    res->count = ks->count;
+    res->timeouts = 0;
+    res->latency = (double *) calloc(ks->count, sizeof(double));
+    res->bytes = (size_t *) calloc(ks->count, sizeof(size_t));
+    double *sent = (double *) calloc(ks->count, sizeof(double));
+    if (!res->latency || !res->bytes || !sent) fail("calloc");
+
+    double interval = O.rate > 0 ? 1e6 / O.rate : 0;
+    double next = now();
+    int nsent = 0, ndone = 0;
+
+    while (ndone < ks->count) {
+        double t = now();
+        if (nsent < ks->count && (interval ? t >= next : nsent == ndone)) {
+            const Key *k = &ks->keys[nsent];
+            if (write(P.fd, k->bytes, k->len) != k->len) fail("write");
+            sent[nsent++] = now();
+            next += interval;
+            continue;
+        }
+
+        int timeout = FRAME_TIMEOUT_MS;
+        if (nsent < ks->count && interval) {
+            timeout = (int) ((next - t) / 1000);
+            if (timeout < 0) timeout = 0;
+        }
+        int frames = editorRead(timeout, res->bytes + ndone, nsent - ndone);
+        if (frames == -1) {
+            fprintf(stderr, "%s exited\n", O.editor);
+            exit(1);
+        }
+
+        double done = now();
+        if (!frames && nsent > ndone && done - sent[ndone] > FRAME_TIMEOUT_MS * 1e3) {
+            /* a key that did not redraw, it is left out of the distribution */
+            res->latency[ndone] = -1;
+            res->timeouts++;
+            ndone++;
+            continue;
+        }
+        for (int i = 0; i < frames && ndone < nsent; i++) {
+            res->latency[ndone] = done - sent[ndone];
+            ndone++;
+        }
+    }
+    free(sent);
+}
+
+/*** report ***/
+static int compareDouble(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    int i = (int) (p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static void report(const char *name, const Result *res) {
+    double *sorted = (double *) malloc(sizeof(double) * (res->count ? res->count : 1));
+    if (!sorted) fail("malloc");
+
+    int n = 0;
+    double sum = 0;
+    size_t bytes = 0, maxBytes = 0;
+    for (int i = 0; i < res->count; i++) {
+        if (res->latency[i] < 0) continue;
+        sorted[n++] = res->latency[i];
+        sum += res->latency[i];
+        bytes += res->bytes[i];
+        if (res->bytes[i] > maxBytes) maxBytes = res->bytes[i];
+    }
+    if (!n) {
+        printf("%-8s %6d keys, no frames\n", name, res->count);
+        free(sorted);
+        return;
+    }
+    qsort(sorted, n, sizeof(double), compareDouble);
+
+    printf("%-8s %6d %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9zu %6d\n", name, n,
+           sorted[0], percentile(sorted, n, 0.5), percentile(sorted, n, 0.9), percentile(sorted, n, 0.99),
+           sorted[n - 1], sum / n, (double) bytes / n, maxBytes, res->timeouts);
+    free(sorted);
+}
+
+/*** init ***/
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-e editor] [-k keyfile] [-r keys/s] [-n repeat] [-s rowsxcols] [file]\n"
+            "  -e  editor binary, default bin/kilo\n"
+            "  -k  recorded key stream, one key per line with C escapes, default built in streams\n"
+            "  -r  keys per second, default 0 sends each key once the previous frame is written\n"
+            "  -n  times each stream is run\n"
+            "  -s  terminal size, default 24x80\n",
+            argv0);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "e:k:r:n:s:h")) != -1) {
+        switch (opt) {
+            case 'e': O.editor = optarg; break;
+            case 'k': O.keyfile = optarg; break;
+            case 'r': O.rate = atof(optarg); break;
+            case 'n': O.repeat = atoi(optarg); break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &O.rows, &O.cols) != 2) usage(argv[0]);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) O.file = argv[optind];
+    if (O.repeat < 1) O.repeat = 1;
+
+    KeyStream streams[4];
+    memset(streams, 0, sizeof(streams));
+    int nstreams = O.keyfile ? streamsLoad(streams, O.keyfile) : streamsBuiltin(streams);
+
+    editorStart();
+    editorSettle();
+
+    printf("%s %s, %dx%d, %s\n", O.editor, O.file, O.rows, O.cols,
+           O.rate > 0 ? "open loop" : "closed loop");
+    if (O.rate > 0) printf("rate %.0f keys/s\n", O.rate);
+    printf("%-8s %6s %9s %9s %9s %9s %9s %9s %9s %9s %6s\n", "stream", "keys",
+           "min us", "p50 us", "p90 us", "p99 us", "max us", "mean us", "bytes", "max b", "lost");
+
+    for (int r = 0; r < O.repeat; r++) {
+        for (int i = 0; i < nstreams; i++) {
+            Result res;
+            measure(&streams[i], &res);
+            report(streams[i].name, &res);
+            free(res.latency);
+            free(res.bytes);
+            editorSettle();
+        }
+    }
+
+    editorStop();
+    for (int i = 0; i < nstreams; i++) free(streams[i].keys);
+    return 0;
+}
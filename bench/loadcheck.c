@@ -0,0 +1,220 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+/*
+ * Loader round trip check
+ * Opens generated files in bin/kilo on a pseudo terminal with KILO_LOAD_CHUNKS forcing the file to be cut
+ * in several chunks, saves each one under another name and compares it with the original byte for byte
+ * Files have uniform line endings, which a save keeps as they are
+ */
+
+/*** defines ***/
+#define SETTLE_MS 300
+#define EXIT_TIMEOUT_MS 5000
+#define LONG_LINE (3 << 20) /* longer than a chunk of every file below */
+
+#define CTRL_KEY(k) ((k) & 0x1f)
+
+/*** data ***/
+typedef struct {
+    const char *name;
+    char *bytes;
+    size_t len;
+} Case;
+
+static struct {
+    const char *editor;
+    char dir[64];
+} O = { "bin/kilo", "/tmp/kiloload.XXXXXX" };
+
+static struct {
+    int fd;
+    pid_t pid;
+} P;
+
+static void fail(const char *s) {
+    perror(s);
+    if (P.pid > 0) kill(P.pid, SIGKILL);
+    exit(1);
+}
+
+/*** cases ***/
+static void caseAppend(Case *c, const char *s, size_t len) {
+    c->bytes = (char *) realloc(c->bytes, c->len + len);
+    if (!c->bytes) fail("realloc");
+    memcpy(c->bytes + c->len, s, len);
+    c->len += len;
+}
+
+static void caseRepeat(Case *c, char ch, size_t n) {
+    c->bytes = (char *) realloc(c->bytes, c->len + n);
+    if (!c->bytes) fail("realloc");
+    memset(c->bytes + c->len, ch, n);
+    c->len += n;
+}
+
+static void caseLines(Case *c, int n, const char *eol) {
+    char line[32];
+    for (int i = 0; i < n; i++) {
+        int len = snprintf(line, sizeof(line), "line %d%s", i, eol);
+        caseAppend(c, line, len);
+    }
+}
+
+/* Lines that span a split point and files without a final newline are the ones chunks get wrong */
+static int casesBuild(Case *cases) {
+    int n = 0;
+    memset(cases, 0, sizeof(Case) * 8);
+
+    cases[n].name = "long line without newline";
+    caseAppend(&cases[n], "{\"a\":\"", 6);
+    caseRepeat(&cases[n], 'x', LONG_LINE);
+    caseAppend(&cases[n++], "\"}", 2);
+
+    cases[n].name = "short line then long one";
+    caseAppend(&cases[n], "short line\n", 11);
+    caseRepeat(&cases[n++], 'x', LONG_LINE);
+
+    cases[n].name = "long line then short one";
+    caseRepeat(&cases[n], 'x', LONG_LINE);
+    caseAppend(&cases[n++], "\nend", 4);
+
+    cases[n].name = "lines";
+    caseLines(&cases[n++], 50000, "\n");
+
+    cases[n].name = "lines without final newline";
+    caseLines(&cases[n], 50000, "\n");
+    cases[n++].len--;
+
+    cases[n].name = "crlf lines";
+    caseLines(&cases[n++], 50000, "\r\n");
+
+    cases[n].name = "blank lines";
+    caseAppend(&cases[n++], "\n\n\n", 3);
+
+    cases[n].name = "single character";
+    caseAppend(&cases[n++], "a", 1);
+    return n;
+}
+
+/*** pseudo terminal ***/
+static void editorStart(const char *file, int chunks) {
+    char value[16];
+    snprintf(value, sizeof(value), "%d", chunks);
+
+    struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+    P.pid = forkpty(&P.fd, NULL, NULL, &ws);
+    if (P.pid == -1) fail("forkpty");
+    if (P.pid == 0) {
+        /* snapshots of the generated files go to the scratch directory and are never restored */
+        setenv("KILO_LOAD_CHUNKS", value, 1);
+        setenv("XDG_CACHE_HOME", O.dir, 1);
+        execl(O.editor, O.editor, file, (char *) NULL);
+        perror(O.editor);
+        _exit(127);
+    }
+}
+
+/* Reads and drops output until the editor stayed quiet for timeout, returns -1 once it is gone */
+static int editorSettle(int timeout) {
+    char buf[65536];
+    struct pollfd pfd = { .fd = P.fd, .events = POLLIN };
+    for (;;) {
+        int ready = poll(&pfd, 1, timeout);
+        if (ready == -1 && errno != EINTR) fail("poll");
+        if (ready == 0) return 0;
+        if (ready > 0 && read(P.fd, buf, sizeof(buf)) <= 0) return -1;
+    }
+}
+
+static void editorKeys(const char *keys) {
+    if (write(P.fd, keys, strlen(keys)) != (ssize_t) strlen(keys)) fail("write");
+    editorSettle(SETTLE_MS);
+}
+
+static void editorStop(void) {
+    if (editorSettle(EXIT_TIMEOUT_MS) != -1) kill(P.pid, SIGKILL);
+    waitpid(P.pid, NULL, 0);
+    close(P.fd);
+    P.pid = 0;
+}
+
+/*** checking ***/
+static int check(const Case *c, int index, int chunks) {
+    char in[128], out[128];
+    snprintf(in, sizeof(in), "%s/in%d", O.dir, index);
+    snprintf(out, sizeof(out), "%s/out%d-%d", O.dir, index, chunks);
+
+    FILE *fp = fopen(in, "w");
+    if (!fp || fwrite(c->bytes, 1, c->len, fp) != c->len || fclose(fp)) fail(in);
+
+    char keys[192];
+    editorStart(in, chunks);
+    editorSettle(SETTLE_MS);
+    snprintf(keys, sizeof(keys), "%c%s\r", CTRL_KEY('w'), out);
+    editorKeys(keys);
+    snprintf(keys, sizeof(keys), "%c", CTRL_KEY('q'));
+    editorKeys(keys);
+    editorStop();
+
+    size_t len = 0;
+    char *saved = NULL;
+    fp = fopen(out, "r");
+    if (fp) {
+        saved = (char *) malloc(c->len + 1);
+        if (!saved) fail("malloc");
+        len = fread(saved, 1, c->len + 1, fp);
+        fclose(fp);
+    }
+    int same = saved && len == c->len && !memcmp(saved, c->bytes, len);
+    printf("%-32s %2d chunks  %s\n", c->name, chunks, same ? "ok" : saved ? "DIFFERS" : "NOT SAVED");
+
+    free(saved);
+    unlink(out);
+    unlink(in);
+    return same;
+}
+
+/* Removes the scratch directory, snapshots were written under it */
+static void cleanup(void) {
+    char cmd[96];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", O.dir);
+    if (system(cmd) == -1) perror("system");
+}
+
+/*** init ***/
+int main(int argc, char *argv[]) {
+    if (argc > 1) O.editor = argv[1];
+    if (!mkdtemp(O.dir)) fail("mkdtemp");
+
+    Case cases[8];
+    int ncases = casesBuild(cases);
+    static const int chunks[] = { 1, 2, 3, 4, 7 };
+
+    int failed = 0;
+    for (int i = 0; i < ncases; i++) {
+        for (size_t k = 0; k < sizeof(chunks) / sizeof(chunks[0]); k++)
+            failed += !check(&cases[i], i, chunks[k]);
+        free(cases[i].bytes);
+    }
+    cleanup();
+
+    printf("%d failed\n", failed);
+    return failed != 0;
+}
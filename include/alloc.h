@@ -0,0 +1,37 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+/* Subsystems allocations are accounted to, reported by the counting and pool backends */
+typedef enum {
+    ALLOC_ROWS = 0,     /* row array, row chars, render and wrap caches */
+    ALLOC_HISTORY,      /* actions, undo tree nodes and checkpoints */
+    ALLOC_SEARCH,       /* search and replace patterns and matches */
+    ALLOC_WINDOW,       /* windows and splits */
+    ALLOC_IO,           /* screen buffer, messages, prompts, file, pipe and macro buffers */
+
+    ALLOC_SUBSYSTEMS,
+} AllocSubsystem;
+
+void allocInit(void);
+
+void allocReport(void);
+
+void *allocMemAt(AllocSubsystem sub, size_t size, const char *func, int line);
+
+void *allocZeroAt(AllocSubsystem sub, size_t size, const char *func, int line);
+
+void *allocResizeAt(AllocSubsystem sub, void *p, size_t size, const char *func, int line);
+
+char *allocStringAt(AllocSubsystem sub, const char *s, const char *func, int line);
+
+void allocFree(void *p);
+
+/* failures end the editor reporting the calling function, callers never see NULL */
+#define allocMem(sub, size) allocMemAt(sub, size, __func__, __LINE__)
+#define allocZero(sub, size) allocZeroAt(sub, size, __func__, __LINE__)
+#define allocResize(sub, p, size) allocResizeAt(sub, p, size, __func__, __LINE__)
+#define allocString(sub, s) allocStringAt(sub, s, __func__, __LINE__)
+
+#endif // !ALLOC_H
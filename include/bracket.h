@@ -0,0 +1,18 @@
+#ifndef BRACKET_H
+#define BRACKET_H
+
+void bracketInvalidate(int at);
+
+void bracketChanged(int at);
+
+int bracketMatch(int y, int x, int *my, int *mx);
+
+int bracketJump(void);
+
+void bracketRefresh(void);
+
+int bracketHighlight(int at, int cols[2]);
+
+void bracketDelete(void);
+
+#endif // !BRACKET_H
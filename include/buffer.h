@@ -0,0 +1,20 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+void bufferInit(void);
+
+int bufferOpen(const char *filename);
+
+int bufferSwitch(int i);
+
+int bufferCount(void);
+
+int bufferActive(void);
+
+int bufferList(char *buf, int size);
+
+void bufferDelete(void);
+
+#endif // !BUFFER_H
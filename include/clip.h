@@ -0,0 +1,20 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+int clipMark(void);
+
+void clipUnmark(void);
+
+int clipSelection(int at, int *from, int *to);
+
+void clipRefresh(void);
+
+int clipCopy(void);
+
+int clipCut(void);
+
+int clipPaste(void);
+
+void clipDelete(void);
+
+#endif // !CLIP_H
@@ -2,6 +2,7 @@
 #define EDITOR_H
 
 #include <string.h>
+#include <sys/types.h>
 #include <termios.h>
 #include <time.h>
 
@@ -10,7 +11,12 @@ struct editorSetting {
     int tabwidth;
     int maxFileNameSize;
     int maxMsgSize;
+    int softwrap; /* long rows continue on the next screen lines instead of scrolling horizontally */
     size_t maxHistory;
+    size_t checkpointInterval; /* least number of edits between two full copies of the buffer kept by history */
+    int maxCheckpoints;
+    size_t bufferBudget; /* bytes all buffers may take before idle, saved buffers are dropped from memory */
+    int internRows; /* identical rows read from files share their chars, see intern.c */
 
     /* 
      * if > 0, then action is appended after that time, 
@@ -20,13 +26,66 @@ struct editorSetting {
 };
 extern struct editorSetting S;
 
+enum editorKey {
+    BACKSPACE = 127,
+    ARROW_UP = 1000,
+    ARROW_DOWN,
+    ARROW_LEFT,
+    ARROW_RIGHT,
+    PAGE_UP,
+    PAGE_DOWN,
+    HOME_KEY,
+    END_KEY,
+    DELETE_KEY,
+    EOL
+};
+
+#define ROW_INLINE_SIZE 16 /* rows shorter than this are stored inside erow, without a heap allocation */
+
+enum erowFlags {
+    ROW_INLINE = 1,    /* chars live in data.buf, otherwise in data.heap */
+    ROW_TABS = 2,      /* render differs from chars */
+    ROW_DIRTY = 4,     /* chars changed since last load/save */
+    ROW_SHARED = 8,    /* chars are in data.heap and also used by other rows, they are copied before being changed */
+    ROW_BRACKETS = 16, /* bclose/bopen are up to date with chars, see bracket.c */
+};
+
+#define ROW_NEW ((unsigned int) -1) /* osize of rows that are not on disk yet */
+
 typedef struct {
     size_t size;
-    char *chars;
     size_t rsize;
-    char *render;
+    char *render; /* only for rows with tabs, built when the row is drawn, NULL otherwise */
+    int *wraps;   /* soft-wrap breakpoints of rows wider than the window, see wrap.c */
+    union {
+        char *heap;
+        char buf[ROW_INLINE_SIZE];
+    } data;
+    unsigned int osize; /* size of the row in the file on disk, ROW_NEW if it is not there */
+    unsigned char flags;
+    unsigned short bclose, bopen; /* unmatched closing brackets at the start of the row, opening ones at the end */
 } erow;
 
+/* rows moved out of the buffer as a whole, e.g. by REPLACE_ROWS actions */
+typedef struct {
+    int count;
+    erow rows[];
+} erowList;
+
+/* data of a REPLACE_ROWS action: the rows it took out of the buffer and the rows it put in their place */
+typedef struct {
+    erowList *removed, *inserted;
+} erowReplace;
+
+#define ROW_CHARS(row) ((row)->flags & ROW_INLINE ? (char *) (row)->data.buf : (row)->data.heap)
+
+/*
+ * Rows flagged ROW_SHARED point into a block that other rows, e.g. of the clipboard or history, point into too
+ * The block holds the chars, the null character and then, aligned, the number of rows using it
+ */
+#define ROW_REFS(chars, size) ((size_t *) ((chars) + (((size) + sizeof(size_t)) & ~(sizeof(size_t) - 1))))
+#define ROW_SHARED_BYTES(size) ((((size) + sizeof(size_t)) & ~(sizeof(size_t) - 1)) + sizeof(size_t))
+
 struct editorMsg {
     char *data;
     int length;
@@ -40,21 +99,83 @@ struct editorMsg {
 struct editorConfig {
     int cx, cy; /* 0 indexed */
     int rx;
-    int screenrows;
+    int screenrows; /* text area of the active window */
     int screencols;
+    int screentop; /* position of active window on the terminal (0 indexed) */
+    int screenleft;
+    int termrows; /* whole terminal, including status and message bar */
+    int termcols;
     erow *row;
     int rowoff; /* Has the value of first line number in the current view area (0
                                    indexed) */
+    int rowsub; /* soft-wrap: first line of row rowoff that is in view */
     int coloff; /* Has the value of first column number in the current view area
                                    (0 indexed) */
     int numrows;
     int max_rx;
+
+    /* state of the last drawn frame, used to repaint only what changed */
+    int prevrowoff; /* -1 forces a full repaint */
+    int prevrowsub;
+    int prevcoloff;
+    int prevwelcome;
+    int dirtystart, dirtyend; /* rows modified since the last frame, dirtyend == INT_MAX -> till end of buffer */
+
     char *filename;
+
+    /* file on disk as of last load/save, used to save only what changed */
+    char eol[3]; /* line terminator used by the file */
+    int eolAtEof; /* last line is terminated too */
+    int firstmoved; /* rows from this index were inserted, removed or shifted since last save */
+    off_t fsize;
+    struct timespec fmtime;
+
     struct editorMsg message;
     struct termios orig_termios;
 };
 extern struct editorConfig E;
 
+int editorRowCxToRx(const erow *row, int cx);
+
+size_t editorRenderSize(const char *chars, size_t size, int *tabs);
+
+void editorUpdateRow(erow *row);
+
+char *editorRowReserve(erow *row, size_t size);
+
+void editorRowSet(erow *row, const char *s, size_t len);
+
+void editorRowAdopt(erow *row, char *chars, size_t len);
+
+void editorRowShare(erow *row, erow *src);
+
+char *editorRowWritable(erow *row);
+
+void editorRowFree(erow *row);
+
+const char *editorRowRender(erow *row);
+
+erowList *editorRowsReplace(int at, int count, erowList *with);
+
+erowList *editorRowsCopy(const erow *rows, int count);
+
+erowList *editorRowsShare(erow *rows, int count);
+
+void editorRowsFree(erowList *list);
+
+void editorRowsLock(void);
+
+void editorRowsUnlock(void);
+
+struct abuf {
+    char *b;
+    size_t len;
+};
+
+void abAppend(struct abuf *ab, const char *s, size_t len);
+
+void abFree(struct abuf *ab);
+
 void editorRowInsertCharAfter(int curline, int cat, const char *s, const int len);
 
 void editorRowInsertCharBefore(int curline, int cat, const char *s, const int len);
@@ -65,4 +186,20 @@ void editorRowInsertBefore(int curline, int cat);
 
 void editorRemoveChars(int curline, int cat, int clen);
 
+void editorMarkDirty(int start, int end);
+
+int editorReadKey(void);
+
+void editorProcessKeyPress(void);
+
+void editorRefreshScreen(void);
+
+int editorOpen(const char *filename);
+
+void editorOpenEmpty(void);
+
+void editorSetMessage(char *fmt, ...);
+
+char *editorPrompt(const char *prompt, int maxlen, void (*callback)(const char *input, int key));
+
 #endif // !EDITOR_H
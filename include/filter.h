@@ -0,0 +1,6 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+int editorFilter(int from, int to, const char *command);
+
+#endif // !FILTER_H
@@ -0,0 +1,14 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include "idle.h"
+
+void editorGrep(void);
+
+int grepVisit(void);
+
+void grepDelete(void);
+
+extern const IdleTask grepTask;
+
+#endif // !GREP_H
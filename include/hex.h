@@ -0,0 +1,29 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+#include "editor.h"
+
+int hexDetect(const char *filename);
+
+int hexOpen(const char *filename);
+
+int hexClose(int force);
+
+int hexActive(void);
+
+void hexProcessKey(int c);
+
+int hexSave(void);
+
+int hexGoto(size_t offset);
+
+void hexDrawRows(struct abuf *ab);
+
+int hexStatus(char *buf, int size);
+
+size_t hexOffset(void);
+
+void hexCursor(int *y, int *x);
+
+#endif // !HEX_H
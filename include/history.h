@@ -5,13 +5,24 @@
 #include "types.h"
 
 struct History {
-    Stack *undoStack, *redoStack;
+    UndoNode *root, *current; /* undo tree, current is the state the buffer is in */
+    size_t count;             /* number of edits in the tree */
+    long seq;
+    size_t sinceCheckpoint;   /* edits added since the last checkpoint was taken */
     Action action;
+    Action group; /* actions committed between begin() and end() */
+    int grouping;
     time_t time;
     void (*undo)(void);
     void (*redo)(void);
     void (*record)(const ActionType type, const char *data, const ssize_t length, const int ax, const int ay);
     void (*commit)(void);
+    void (*push)(Action *act);
+    void (*begin)(void);
+    void (*end)(void);
+    long (*travel)(time_t when);
+    int (*branch)(int *count);
+    void (*sync)(void);
     void (*delete)(void);
 };
 extern struct History H;
@@ -0,0 +1,24 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+/*
+ * Background work that runs between key presses
+ * pending() returns 0 while the task has nothing to do, otherwise it sets fd to a descriptor to wait on (-1 for none)
+ * and timeout to the milliseconds after its last step when it is to run again anyway (-1 for never, 0 for right away)
+ * step() works for about budget nanoseconds and returns 1 when it changed what is on screen
+ * progress() returns how far the task is in permille, -1 when that is not known, it can be NULL
+ */
+typedef struct {
+    const char *name;
+    int (*pending)(int *fd, int *timeout);
+    int (*step)(long budget);
+    int (*progress)(void);
+} IdleTask;
+
+void idleAdd(const IdleTask *task);
+
+int idleRun(int input);
+
+int idleStats(char *buf, int size);
+
+#endif // !IDLE_H
@@ -0,0 +1,16 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+void inputStart(void);
+
+int inputFd(void);
+
+int inputKey(void);
+
+int inputEscape(void);
+
+int inputHeld(void);
+
+int inputStats(char *buf, int size);
+
+#endif // !INPUT_H
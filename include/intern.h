@@ -0,0 +1,13 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include "editor.h"
+
+void internRow(erow *row, const char *s, size_t len);
+
+void internForget(const char *chars, size_t size);
+
+void internDelete(void);
+
+#endif // !INTERN_H
@@ -0,0 +1,8 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+int loadIndexed(int fd, int *uniform);
+
+void loadPreview(int on);
+
+#endif // !LOAD_H
@@ -0,0 +1,20 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+void macroStartRecording(void);
+
+void macroStopRecording(void);
+
+int macroIsRecording(void);
+
+int macroIsReplaying(void);
+
+void macroRecordKey(int c);
+
+int macroNextKey(int *c);
+
+void macroReplay(int times);
+
+void macroDelete(void);
+
+#endif // !MACRO_H
@@ -0,0 +1,17 @@
+#ifndef REPLACE_H
+#define REPLACE_H
+
+#include <stddef.h>
+#include "types.h"
+
+int editorReplaceAll(const char *pattern, const char *replacement, int ignoreCase);
+
+void replaceInvert(Action *act);
+
+void replacePerform(Action *act);
+
+size_t replaceSize(const Action *act);
+
+int replaceValid(const char *data, size_t size, size_t rows, size_t cols);
+
+#endif // !REPLACE_H
@@ -0,0 +1,16 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "idle.h"
+
+void editorFind(void);
+
+int searchActive(void);
+
+int searchCurrent(int *row, int *col, int *len);
+
+int searchStatus(char *buf, int size);
+
+extern const IdleTask searchTask;
+
+#endif // !SEARCH_H
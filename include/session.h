@@ -0,0 +1,8 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+int sessionLoad(const char *filename);
+
+void sessionSave(void);
+
+#endif // !SESSION_H
@@ -4,14 +4,6 @@
 #include <sys/types.h>
 #include "types.h"
 
-Stack* stackInit(void);
-
-const Action* stackPeek(const Stack *s);
-
-void stackClear(Stack *s);
-
-void stackDelete(Stack *s);
-
 void actionFlush(Action *act);
 
 void actionDelete(Action *act);
@@ -24,8 +16,8 @@ void actionAppend(Action *act, const char *s, const ssize_t dlength, const int d
 
 void actionTypeConv(Action *act, ActionType newType);
 
-void actionCommit(Action *act, Stack *s);
+void actionGroupAppend(Action *group, Action *act);
 
-Action* actionPop(Stack *s);
+Action* actionGroupPop(Action *group);
 
 #endif // !STACK_H
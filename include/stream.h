@@ -0,0 +1,23 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include "idle.h"
+
+void streamOpenStdin(void);
+
+int streamPending(void);
+
+size_t streamLoaded(void);
+
+int followStart(void);
+
+void followStop(void);
+
+int followActive(void);
+
+extern const IdleTask streamTask;
+
+extern const IdleTask followTask;
+
+#endif // !STREAM_H
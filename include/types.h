@@ -13,17 +13,25 @@ typedef enum {
     REMOVE_LINE_BEF,
     INSERT_LINE_AFT,
     REMOVE_LINE_AFT,
+
+    REPLACE_TEXT,
+    REPLACE_ROWS,
+
+    ACTION_GROUP,
 } ActionType;
 
-typedef struct {
+typedef struct Action {
     ssize_t length;
     int ax, ay;
     ActionType type;
     char *data;
+
+    /* ACTION_GROUP only: actions that are undone/redone together, length holds their count */
+    struct Action *sub;
 } Action;
 
-struct Stack;
-typedef struct Stack Stack;
+struct UndoNode;
+typedef struct UndoNode UndoNode;
 
 struct History;
 typedef struct History History;
@@ -0,0 +1,42 @@
+#ifndef UNDOTREE_H
+#define UNDOTREE_H
+
+#include <stddef.h>
+#include <time.h>
+#include "types.h"
+#include "editor.h"
+
+/* A full copy of the buffer at some state, so that far away states are reached without replaying every edit */
+typedef struct {
+    erowList *rows;
+    int cx, cy;
+} Checkpoint;
+
+/*
+ * Every state of the buffer is a node, and the edge to its parent is the action that led there
+ * Actions on the path from the root to the current state are in done form, all others in inverse form
+ */
+struct UndoNode {
+    Action action;
+    struct UndoNode *parent;
+    struct UndoNode *child, *next; /* newest child, next older sibling */
+    struct UndoNode *redo;         /* child that redo follows */
+    long seq;                      /* creation order */
+    int depth;
+    time_t time;
+    Checkpoint *checkpoint;
+};
+
+UndoNode* treeAdd(UndoNode *parent, Action *act, long seq);
+
+size_t treeDelete(UndoNode *node);
+
+UndoNode* treeNext(UndoNode *node, const UndoNode *root);
+
+UndoNode* treeCommonAncestor(UndoNode *a, UndoNode *b);
+
+void treeDropCheckpoints(UndoNode *root);
+
+void checkpointDelete(Checkpoint *cp);
+
+#endif // !UNDOTREE_H
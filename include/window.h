@@ -0,0 +1,33 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include "editor.h"
+#include "idle.h"
+
+void windowInit(void);
+
+void windowLayout(void);
+
+int windowSplit(int vertical);
+
+int windowClose(void);
+
+void windowNext(void);
+
+int windowCount(void);
+
+int windowActive(void);
+
+void windowLoad(int i);
+
+void windowStore(int i);
+
+void windowDrawSeparators(struct abuf *ab);
+
+void windowDelete(void);
+
+void windowResizeInit(void);
+
+extern const IdleTask resizeTask;
+
+#endif // !WINDOW_H
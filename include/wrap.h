@@ -0,0 +1,18 @@
+#ifndef WRAP_H
+#define WRAP_H
+
+#include "editor.h"
+
+int wrapLines(erow *row);
+
+int wrapStart(erow *row, int line);
+
+int wrapLineOf(erow *row, int rx);
+
+void wrapUp(int *row, int *line, int n);
+
+int wrapDistance(int fromrow, int fromline, int torow, int toline, int limit);
+
+int wrapLinesBelow(int row, int line, int limit);
+
+#endif // !WRAP_H
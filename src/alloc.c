@@ -0,0 +1,274 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+#include "alloc.h"
+
+/*** defines ***/
+#define ALLOC_ENV "KILO_ALLOC"
+
+/* the pool backend serves blocks of up to POOL_CLASSES * POOL_GRAIN bytes from per size free lists */
+#define POOL_GRAIN 16
+#define POOL_CLASSES 16
+#define POOL_SLAB (64 * 1024)
+
+/*** data ***/
+typedef enum {
+    BACKEND_LIBC = 0,
+    BACKEND_COUNT,
+    BACKEND_POOL,
+} AllocBackend;
+
+static const char *backendNames[] = { "libc", "count", "pool" };
+
+static const char *subsystemNames[ALLOC_SUBSYSTEMS] = { "rows", "history", "search", "window", "io" };
+
+/*
+ * Description:
+ * Precedes every block of the counting and pool backends
+ * The union keeps the memory after it aligned like malloc() does
+ */
+typedef union {
+    struct {
+        size_t size;
+        unsigned char sub;
+        unsigned char cls;  /* size class of pool blocks, 0 for blocks from libc */
+    } h;
+    long double align;
+} BlockHeader;
+
+/* a freed pool block, the link lives where the caller's data was */
+typedef struct PoolBlock {
+    struct PoolBlock *next;
+} PoolBlock;
+
+typedef struct {
+    PoolBlock *free;
+    size_t carved, reused;
+} PoolClass;
+
+typedef struct {
+    size_t calls, resizes, frees;
+    size_t bytes, live, peak;
+} AllocCounter;
+
+static struct {
+    AllocBackend backend;
+    pthread_mutex_t lock;   /* the search worker allocates too */
+
+    AllocCounter count[ALLOC_SUBSYSTEMS];
+
+    PoolClass pool[POOL_CLASSES + 1];
+    BlockHeader *slabs;     /* every slab starts with a header whose size links to the next slab */
+    char *slabNext;
+    size_t slabLeft;
+} A = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*** counting ***/
+static void allocCount(AllocSubsystem sub, size_t oldsize, size_t newsize, int isResize) {
+    AllocCounter *c = &A.count[sub];
+    if (isResize) c->resizes++;
+    else c->calls++;
+    if (newsize > oldsize) c->bytes += newsize - oldsize;
+    c->live += newsize - oldsize;
+    if (c->live > c->peak) c->peak = c->live;
+}
+
+/*** pool ***/
+static int poolClass(size_t size) {
+    if (A.backend != BACKEND_POOL || size > POOL_CLASSES * POOL_GRAIN) return 0;
+    return (size + POOL_GRAIN - 1) / POOL_GRAIN;
+}
+
+/* Returns a block of class cls, or NULL when a new slab could not be allocated */
+static BlockHeader *poolTake(int cls) {
+    PoolClass *pc = &A.pool[cls];
+    if (pc->free) {
+        BlockHeader *b = (BlockHeader *) pc->free - 1;
+        pc->free = pc->free->next;
+        pc->reused++;
+        return b;
+    }
+
+    size_t bsize = sizeof(BlockHeader) + cls * POOL_GRAIN;
+    if (A.slabLeft < bsize) {
+        BlockHeader *slab = (BlockHeader *) malloc(POOL_SLAB);
+        if (!slab) return NULL;
+        slab->h.size = (size_t) A.slabs;
+        A.slabs = slab;
+        A.slabNext = (char *) (slab + 1);
+        A.slabLeft = POOL_SLAB - sizeof(BlockHeader);
+    }
+    BlockHeader *b = (BlockHeader *) A.slabNext;
+    A.slabNext += bsize;
+    A.slabLeft -= bsize;
+    pc->carved++;
+    return b;
+}
+
+static void poolGive(BlockHeader *b) {
+    PoolBlock *block = (PoolBlock *) (b + 1);
+    block->next = A.pool[b->h.cls].free;
+    A.pool[b->h.cls].free = block;
+}
+
+/*** blocks ***/
+/* Allocates a block with a header, returns NULL on failure, A.lock must be held */
+static void *blockAlloc(AllocSubsystem sub, size_t size) {
+    int cls = poolClass(size);
+    BlockHeader *b = cls ? poolTake(cls) : (BlockHeader *) malloc(sizeof(BlockHeader) + size);
+    if (!b) return NULL;
+
+    b->h.size = size;
+    b->h.sub = sub;
+    b->h.cls = cls;
+    allocCount(sub, 0, size, 0);
+    return b + 1;
+}
+
+static void blockFree(BlockHeader *b) {
+    AllocCounter *c = &A.count[b->h.sub];
+    c->frees++;
+    c->live -= b->h.size;
+    if (b->h.cls) poolGive(b);
+    else free(b);
+}
+
+/* Resizes the block of p, returns NULL on failure leaving p intact, A.lock must be held */
+static void *blockResize(void *p, size_t size) {
+    BlockHeader *b = (BlockHeader *) p - 1;
+    AllocSubsystem sub = b->h.sub;
+
+    /* pool blocks are only moved when they outgrow their class */
+    if (b->h.cls && size <= (size_t) b->h.cls * POOL_GRAIN) {
+        allocCount(sub, b->h.size, size, 1);
+        b->h.size = size;
+        return p;
+    }
+
+    if (!b->h.cls) {
+        size_t oldsize = b->h.size;
+        b = (BlockHeader *) realloc(b, sizeof(BlockHeader) + size);
+        if (!b) return NULL;
+        b->h.size = size;
+        allocCount(sub, oldsize, size, 1);
+        return b + 1;
+    }
+
+    void *q = blockAlloc(sub, size);
+    if (!q) return NULL;
+    memcpy(q, p, b->h.size < size ? b->h.size : size);
+    /* a move is a single resize of the subsystem, not an allocation and a free */
+    A.count[sub].calls--;
+    A.count[sub].frees--;
+    A.count[sub].resizes++;
+    blockFree(b);
+    return q;
+}
+
+/*** interface ***/
+/*
+ * Description:
+ * Chooses the backend named by the KILO_ALLOC environment variable, libc when unset or unknown
+ * Must run before anything is allocated, blocks can only be freed by the backend that made them
+ */
+void allocInit(void) {
+    const char *name = getenv(ALLOC_ENV);
+    A.backend = BACKEND_LIBC;
+    for (int i = 0; name && i < (int) (sizeof(backendNames) / sizeof(backendNames[0])); i++) {
+        if (!strcmp(name, backendNames[i])) A.backend = (AllocBackend) i;
+    }
+    if (A.backend != BACKEND_LIBC) atexit(allocReport);
+}
+
+/*
+ * Description:
+ * Prints calls and bytes per subsystem to stderr, live bytes left at exit are leaks
+ */
+void allocReport(void) {
+    if (A.backend == BACKEND_LIBC) return;
+
+    pthread_mutex_lock(&A.lock);
+    fprintf(stderr, "allocator: %s\n", backendNames[A.backend]);
+    fprintf(stderr, "%-10s %10s %10s %10s %12s %10s %10s\n",
+            "subsystem", "calls", "resizes", "frees", "bytes", "live", "peak");
+    for (int i = 0; i < ALLOC_SUBSYSTEMS; i++) {
+        AllocCounter *c = &A.count[i];
+        fprintf(stderr, "%-10s %10zu %10zu %10zu %12zu %10zu %10zu\n",
+                subsystemNames[i], c->calls, c->resizes, c->frees, c->bytes, c->live, c->peak);
+    }
+
+    if (A.backend == BACKEND_POOL) {
+        fprintf(stderr, "%-10s %10s %10s\n", "class", "carved", "reused");
+        for (int i = 1; i <= POOL_CLASSES; i++) {
+            if (!A.pool[i].carved) continue;
+            fprintf(stderr, "%-10d %10zu %10zu\n", i * POOL_GRAIN, A.pool[i].carved, A.pool[i].reused);
+        }
+    }
+    pthread_mutex_unlock(&A.lock);
+}
+
+void *allocMemAt(AllocSubsystem sub, size_t size, const char *func, int line) {
+    if (!size) size = 1;
+
+    void *p;
+    if (A.backend == BACKEND_LIBC) {
+        p = malloc(size);
+    } else {
+        pthread_mutex_lock(&A.lock);
+        p = blockAlloc(sub, size);
+        pthread_mutex_unlock(&A.lock);
+    }
+    if (!p) die("In function: %s\r\nAt line: %d\r\nmalloc", func, line);
+    return p;
+}
+
+void *allocZeroAt(AllocSubsystem sub, size_t size, const char *func, int line) {
+    void *p = allocMemAt(sub, size, func, line);
+    memset(p, 0, size);
+    return p;
+}
+
+/*
+ * Description:
+ * Resizes p like realloc(), a NULL p is allocated for sub
+ * A block stays accounted to the subsystem that allocated it
+ */
+void *allocResizeAt(AllocSubsystem sub, void *p, size_t size, const char *func, int line) {
+    if (!p) return allocMemAt(sub, size, func, line);
+    if (!size) size = 1;
+
+    void *q;
+    if (A.backend == BACKEND_LIBC) {
+        q = realloc(p, size);
+    } else {
+        pthread_mutex_lock(&A.lock);
+        q = blockResize(p, size);
+        pthread_mutex_unlock(&A.lock);
+    }
+    if (!q) die("In function: %s\r\nAt line: %d\r\nrealloc", func, line);
+    return q;
+}
+
+char *allocStringAt(AllocSubsystem sub, const char *s, const char *func, int line) {
+    size_t len = strlen(s);
+    char *copy = (char *) allocMemAt(sub, len + 1, func, line);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+void allocFree(void *p) {
+    if (!p) return;
+    if (A.backend == BACKEND_LIBC) {
+        free(p);
+        return;
+    }
+    pthread_mutex_lock(&A.lock);
+    blockFree((BlockHeader *) p - 1);
+    pthread_mutex_unlock(&A.lock);
+}
@@ -0,0 +1,285 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <limits.h>
+#include <string.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "bracket.h"
+
+#define BRACKET_BLOCK 256 /* rows summarised together, a match is looked for a block at a time */
+
+/*
+ * Brackets of all kinds share one nesting depth, text in strings and comments is not told apart
+ * A run of text reduces to the closing brackets it has no opening one for, followed by the opening ones
+ * it has no closing one for. Every row caches this in bclose/bopen, and every BRACKET_BLOCK rows are
+ * summarised in blocks, so looking for a match skips over rows and blocks that can not hold it, only the
+ * row it is in is scanned
+ * A row changed in place only makes the summaries of its row and its block stale, rows inserted or removed
+ * invalidate every block from theirs on, as the rows after them move to other blocks. Both are computed
+ * again when a match is looked for
+ */
+typedef struct {
+    int close, open;
+} BracketSpan;
+
+static struct {
+    BracketSpan *blocks;
+    unsigned char *stale; /* blocks in [0, valid) whose rows were changed in place since */
+    int capacity;
+    int valid; /* blocks [0, valid) cover the rows they did when computed */
+
+    /* pair around the cursor of the active window, as of the last frame, rows are -1 when there is none */
+    int y1, x1, y2, x2;
+} K = {NULL, NULL, 0, 0, -1, 0, -1, 0};
+
+static const char bracketOpen[] = "([{";
+static const char bracketClose[] = ")]}";
+
+/* 1 for an opening bracket, -1 for a closing one, 0 otherwise */
+static int bracketKind(char c) {
+    if (!c) return 0;
+    if (strchr(bracketOpen, c)) return 1;
+    if (strchr(bracketClose, c)) return -1;
+    return 0;
+}
+
+static int bracketPairs(char open, char close) {
+    return strchr(bracketOpen, open) - bracketOpen == strchr(bracketClose, close) - bracketClose;
+}
+
+/* Span of a followed by b */
+static BracketSpan bracketJoin(BracketSpan a, BracketSpan b) {
+    BracketSpan span = {a.close, b.open};
+    if (b.close > a.open) span.close += b.close - a.open;
+    else span.open += a.open - b.close;
+    return span;
+}
+
+static BracketSpan bracketScan(const char *chars, size_t len) {
+    BracketSpan span = {0, 0};
+    for (size_t i = 0; i < len; i++) {
+        int kind = bracketKind(chars[i]);
+        if (kind > 0) span.open++;
+        else if (kind < 0 && span.open) span.open--;
+        else if (kind < 0) span.close++;
+    }
+    return span;
+}
+
+/* A row with more unmatched brackets than fit in its summary is scanned every time */
+static BracketSpan bracketRow(erow *row) {
+    if (row->flags & ROW_BRACKETS) return (BracketSpan) {row->bclose, row->bopen};
+
+    BracketSpan span = bracketScan(ROW_CHARS(row), row->size);
+    if (span.close <= USHRT_MAX && span.open <= USHRT_MAX) {
+        row->bclose = span.close;
+        row->bopen = span.open;
+        row->flags |= ROW_BRACKETS;
+    }
+    return span;
+}
+
+static void bracketSummarise(int b) {
+    BracketSpan span = {0, 0};
+    int end = (b + 1) * BRACKET_BLOCK < E.numrows ? (b + 1) * BRACKET_BLOCK : E.numrows;
+    for (int r = b * BRACKET_BLOCK; r < end; r++)
+        span = bracketJoin(span, bracketRow(&E.row[r]));
+    K.blocks[b] = span;
+    K.stale[b] = 0;
+}
+
+static BracketSpan bracketBlock(int b) {
+    if (b >= K.capacity) {
+        K.capacity = b * 2 + 16;
+        K.blocks = (BracketSpan *) allocResize(ALLOC_ROWS, K.blocks, sizeof(BracketSpan) * K.capacity);
+        K.stale = (unsigned char *) allocResize(ALLOC_ROWS, K.stale, K.capacity);
+    }
+    if (b < K.valid && K.stale[b]) bracketSummarise(b);
+    for (; K.valid <= b; K.valid++)
+        bracketSummarise(K.valid);
+    return K.blocks[b];
+}
+
+/*
+ * Description:
+ * Forgets the summaries from row at on, called whenever rows are inserted or removed at at
+ */
+void bracketInvalidate(int at) {
+    if (at < 0) at = 0;
+    if (at / BRACKET_BLOCK < K.valid) K.valid = at / BRACKET_BLOCK;
+}
+
+/*
+ * Description:
+ * Forgets the summary of the block of row at, called whenever row at is changed in place
+ */
+void bracketChanged(int at) {
+    if (at >= 0 && at / BRACKET_BLOCK < K.valid) K.stale[at / BRACKET_BLOCK] = 1;
+}
+
+/* Looks for the bracket closing depth levels in row at, from column from on */
+static int bracketFindClose(int at, int from, int *depth) {
+    const char *chars = ROW_CHARS(&E.row[at]);
+    for (int i = from; i < (int) E.row[at].size; i++) {
+        int kind = bracketKind(chars[i]);
+        if (kind && !(*depth += kind)) return i;
+    }
+    return -1;
+}
+
+/* Looks for the bracket opening depth levels in row at, from column from back */
+static int bracketFindOpen(int at, int from, int *depth) {
+    const char *chars = ROW_CHARS(&E.row[at]);
+    for (int i = from; i >= 0; i--) {
+        int kind = bracketKind(chars[i]);
+        if (kind && !(*depth -= kind)) return i;
+    }
+    return -1;
+}
+
+static int bracketForward(int y, int x, int *my, int *mx) {
+    int depth = 1;
+    int col = bracketFindClose(y, x + 1, &depth);
+    int r = y;
+    while (col < 0 && ++r < E.numrows) {
+        if (r % BRACKET_BLOCK == 0) {
+            BracketSpan block = bracketBlock(r / BRACKET_BLOCK);
+            if (block.close < depth) {
+                depth += block.open - block.close;
+                r += BRACKET_BLOCK - 1;
+                continue;
+            }
+        }
+        BracketSpan span = bracketRow(&E.row[r]);
+        if (span.close < depth) depth += span.open - span.close;
+        else col = bracketFindClose(r, 0, &depth);
+    }
+    if (col < 0) return 0;
+    *my = r;
+    *mx = col;
+    return 1;
+}
+
+static int bracketBackward(int y, int x, int *my, int *mx) {
+    int depth = 1;
+    int col = bracketFindOpen(y, x - 1, &depth);
+    int r = y;
+    while (col < 0 && --r >= 0) {
+        if ((r + 1) % BRACKET_BLOCK == 0) {
+            BracketSpan block = bracketBlock(r / BRACKET_BLOCK);
+            if (block.open < depth) {
+                depth += block.close - block.open;
+                r -= BRACKET_BLOCK - 1;
+                continue;
+            }
+        }
+        BracketSpan span = bracketRow(&E.row[r]);
+        if (span.open < depth) depth += span.close - span.open;
+        else col = bracketFindOpen(r, (int) E.row[r].size - 1, &depth);
+    }
+    if (col < 0) return 0;
+    *my = r;
+    *mx = col;
+    return 1;
+}
+
+/*
+ * Description:
+ * Finds the bracket that pairs with the one at column x of row y
+ * Returns 0 when there is no bracket there, no bracket at the same depth, or one of another kind
+ */
+int bracketMatch(int y, int x, int *my, int *mx) {
+    if (y < 0 || y >= E.numrows || x < 0 || x >= (int) E.row[y].size) return 0;
+    char c = ROW_CHARS(&E.row[y])[x];
+    int kind = bracketKind(c);
+    if (!kind) return 0;
+
+    /* summaries are written while a search worker may be reading the rows */
+    editorRowsLock();
+    int found = kind > 0 ? bracketForward(y, x, my, mx) : bracketBackward(y, x, my, mx);
+    editorRowsUnlock();
+    if (!found) return 0;
+
+    char other = ROW_CHARS(&E.row[*my])[*mx];
+    return kind > 0 ? bracketPairs(c, other) : bracketPairs(other, c);
+}
+
+/* The bracket under the cursor, or else the one right before it */
+static int bracketAtCursor(int *x, int *my, int *mx) {
+    if (E.cy >= E.numrows) return 0;
+    *x = E.cx;
+    if (bracketMatch(E.cy, *x, my, mx)) return 1;
+    *x = E.cx - 1;
+    return bracketMatch(E.cy, *x, my, mx);
+}
+
+/*
+ * Description:
+ * Moves the cursor to the bracket that pairs with the one at the cursor
+ * Returns 0 when there is none
+ */
+int bracketJump(void) {
+    int x, my, mx;
+    if (!bracketAtCursor(&x, &my, &mx)) return 0;
+    E.cy = my;
+    E.cx = mx;
+    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    E.max_rx = E.rx;
+    return 1;
+}
+
+/*
+ * Description:
+ * Looks for the pair around the cursor, rows of the pair drawn last frame and of the new one are repainted
+ */
+void bracketRefresh(void) {
+    int x, y1 = -1, x1 = 0, y2 = -1, x2 = 0;
+    if (bracketAtCursor(&x, &y2, &x2)) {
+        y1 = E.cy;
+        x1 = x;
+    } else {
+        y2 = -1; /* a bracket of another kind might have been found */
+        x2 = 0;
+    }
+    if (y1 == K.y1 && x1 == K.x1 && y2 == K.y2 && x2 == K.x2) return;
+
+    if (K.y1 >= 0) {
+        editorMarkDirty(K.y1, K.y1);
+        editorMarkDirty(K.y2, K.y2);
+    }
+    K.y1 = y1;
+    K.x1 = x1;
+    K.y2 = y2;
+    K.x2 = x2;
+    if (K.y1 >= 0) {
+        editorMarkDirty(K.y1, K.y1);
+        editorMarkDirty(K.y2, K.y2);
+    }
+}
+
+/*
+ * Description:
+ * Gets the columns of row at that hold a bracket of the pair around the cursor, in order
+ * Returns their number
+ */
+int bracketHighlight(int at, int cols[2]) {
+    int n = 0;
+    if (K.y1 < 0) return 0;
+    int first = K.y1 < K.y2 || (K.y1 == K.y2 && K.x1 < K.x2);
+    int ya = first ? K.y1 : K.y2, xa = first ? K.x1 : K.x2;
+    int yb = first ? K.y2 : K.y1, xb = first ? K.x2 : K.x1;
+    if (ya == at) cols[n++] = xa;
+    if (yb == at) cols[n++] = xb;
+    return n;
+}
+
+void bracketDelete(void) {
+    allocFree(K.blocks);
+    K.blocks = NULL;
+    allocFree(K.stale);
+    K.stale = NULL;
+    K.capacity = K.valid = 0;
+}
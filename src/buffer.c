@@ -0,0 +1,320 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "history.h"
+#include "undotree.h"
+#include "stream.h"
+#include "window.h"
+#include "bracket.h"
+#include "buffer.h"
+#include "clip.h"
+
+/*** buffers ***/
+/*
+ * Every buffer holds the rows, file state and history of one file
+ * The active buffer lives in E and H, all the others are parked in their editorBuffer
+ * Parked fields only mean something while the buffer is parked, loading it moves them back
+ */
+struct editorBuffer {
+    erow *row; /* NULL while evicted */
+    int numrows;
+    char *filename;
+    char eol[3];
+    int eolAtEof;
+    int firstmoved;
+    off_t fsize;
+    struct timespec fmtime;
+
+    struct History history;
+
+    /* view of the active window when the buffer was left */
+    int cx, cy, rx, max_rx;
+    int rowoff, rowsub, coloff;
+
+    int evicted;        /* rows were dropped to stay in the memory budget, they are read back from the file */
+    unsigned long used; /* when the buffer was left, the least recently used one is evicted first */
+};
+
+static struct {
+    struct editorBuffer *bufs;
+    int count;
+    int active;
+    unsigned long clock;
+} B = {NULL, 0, 0, 0};
+
+/*** memory ***/
+static size_t bufferRowsBytes(const erow *rows, int count) {
+    size_t bytes = sizeof(erow) * count;
+    for (int i = 0; i < count; i++) {
+        if (!(rows[i].flags & ROW_INLINE)) bytes += rows[i].size + 1;
+        if (rows[i].render) bytes += rows[i].rsize + 1;
+    }
+    return bytes;
+}
+
+/* Rows of the buffer and the copies of them kept by its checkpoints */
+static size_t bufferBytes(const struct editorBuffer *b) {
+    size_t bytes = b->evicted ? 0 : bufferRowsBytes(b->row, b->numrows);
+    for (UndoNode *node = b->history.root; node; node = treeNext(node, b->history.root)) {
+        if (node->checkpoint)
+            bytes += sizeof(erowList) + bufferRowsBytes(node->checkpoint->rows->rows, node->checkpoint->rows->count);
+    }
+    return bytes;
+}
+
+/* A parked buffer can be evicted when it is the same as the file it was loaded from or saved to */
+static int bufferEvictable(const struct editorBuffer *b) {
+    if (b->evicted || !b->filename || b->firstmoved != INT_MAX) return 0;
+    if (!b->fsize && !b->fmtime.tv_sec && !b->fmtime.tv_nsec) return 0;
+    for (int i = 0; i < b->numrows; i++) {
+        if (b->row[i].flags & ROW_DIRTY) return 0;
+    }
+    return 1;
+}
+
+static void bufferEvict(struct editorBuffer *b) {
+    for (int i = 0; i < b->numrows; i++)
+        editorRowFree(&b->row[i]);
+    allocFree(b->row);
+    b->row = NULL;
+    b->evicted = 1;
+
+    treeDropCheckpoints(b->history.root);
+}
+
+/*
+ * Description:
+ * Evicts the least recently used parked buffers until all buffers fit in S.bufferBudget
+ * The active buffer and buffers with unsaved changes are always kept
+ */
+static void bufferBudget(void) {
+    size_t total = bufferRowsBytes(E.row, E.numrows);
+    for (int i = 0; i < B.count; i++) {
+        if (i != B.active) total += bufferBytes(&B.bufs[i]);
+    }
+
+    while (total > S.bufferBudget) {
+        struct editorBuffer *lru = NULL;
+        for (int i = 0; i < B.count; i++) {
+            struct editorBuffer *b = &B.bufs[i];
+            if (i != B.active && bufferEvictable(b) && (!lru || b->used < lru->used)) lru = b;
+        }
+        if (!lru) return;
+
+        total -= bufferBytes(lru);
+        bufferEvict(lru);
+    }
+}
+
+/*** switching ***/
+static void bufferStore(int i) {
+    struct editorBuffer *b = &B.bufs[i];
+    b->row = E.row;
+    b->numrows = E.numrows;
+    b->filename = E.filename;
+    memcpy(b->eol, E.eol, sizeof(b->eol));
+    b->eolAtEof = E.eolAtEof;
+    b->firstmoved = E.firstmoved;
+    b->fsize = E.fsize;
+    b->fmtime = E.fmtime;
+    b->history = H;
+    b->cx = E.cx;
+    b->cy = E.cy;
+    b->rx = E.rx;
+    b->max_rx = E.max_rx;
+    b->rowoff = E.rowoff;
+    b->rowsub = E.rowsub;
+    b->coloff = E.coloff;
+    b->evicted = 0;
+    b->used = ++B.clock;
+
+    /* render and wrap caches are rebuilt when the rows are drawn again */
+    for (int r = 0; r < b->numrows; r++) {
+        allocFree(b->row[r].render);
+        b->row[r].render = NULL;
+        allocFree(b->row[r].wraps);
+        b->row[r].wraps = NULL;
+    }
+}
+
+/*
+ * Description:
+ * Makes buffer i current in E and H
+ * An evicted buffer is read back from its file, its history is dropped if the file changed meanwhile
+ */
+static void bufferLoad(int i) {
+    struct editorBuffer *b = &B.bufs[i];
+    H = b->history;
+    E.row = b->row;
+    E.numrows = b->numrows;
+    E.filename = b->filename;
+    memcpy(E.eol, b->eol, sizeof(E.eol));
+    E.eolAtEof = b->eolAtEof;
+    E.firstmoved = b->firstmoved;
+    E.fsize = b->fsize;
+    E.fmtime = b->fmtime;
+
+    if (b->evicted) {
+        E.row = NULL;
+        E.numrows = 0;
+        E.filename = NULL;
+        editorOpen(b->filename); /* gone with its directory, the buffer is left empty and the message says so */
+        allocFree(b->filename);
+
+        if (E.fsize != b->fsize || E.fmtime.tv_sec != b->fmtime.tv_sec || E.fmtime.tv_nsec != b->fmtime.tv_nsec) {
+            H.delete();
+            historyInit();
+            editorSetMessage("%s changed on disk, undo history dropped", E.filename);
+        }
+        b->evicted = 0;
+    }
+
+    E.cx = b->cx;
+    E.cy = b->cy;
+    E.rx = b->rx;
+    E.max_rx = b->max_rx;
+    E.rowoff = b->rowoff;
+    E.rowsub = b->rowsub;
+    E.coloff = b->coloff;
+    E.dirtystart = 1;
+    E.dirtyend = 0;
+
+    B.active = i;
+    bracketInvalidate(0);
+    windowLayout(); /* clamps the view and repaints every window */
+}
+
+void bufferInit(void) {
+    B.bufs = (struct editorBuffer *) allocMem(ALLOC_IO, sizeof(struct editorBuffer));
+    B.count = 1;
+    B.active = 0;
+}
+
+/*
+ * Description:
+ * Switches to buffer i
+ * Returns 0 while stdin is still being read into the active buffer
+ */
+int bufferSwitch(int i) {
+    if (streamPending()) return 0;
+    if (i == B.active) return 1;
+
+    followStop();
+    clipUnmark();
+    H.commit();
+    bufferStore(B.active);
+    bufferLoad(i);
+    bufferBudget();
+    return 1;
+}
+
+/*
+ * Description:
+ * Opens filename in a new buffer and switches to it, or switches to the buffer that already has it open
+ * A NULL filename opens a new empty buffer that has no file
+ * Returns 0 while stdin is still being read into the active buffer, -1 when the file can not be opened
+ */
+int bufferOpen(const char *filename) {
+    if (streamPending()) return 0;
+
+    for (int i = 0; i < B.count && filename; i++) {
+        const char *name = i == B.active ? E.filename : B.bufs[i].filename;
+        if (name && !strcmp(name, filename)) return bufferSwitch(i);
+    }
+
+    followStop();
+    clipUnmark();
+    H.commit();
+    B.bufs = (struct editorBuffer *) allocResize(ALLOC_IO, B.bufs, sizeof(struct editorBuffer) * (B.count + 1));
+    bufferStore(B.active);
+    int previous = B.active;
+    B.active = B.count++;
+
+    E.row = NULL;
+    E.numrows = 0;
+    E.filename = NULL;
+    E.cx = E.cy = E.rx = E.max_rx = 0;
+    E.rowoff = E.rowsub = E.coloff = 0;
+    E.dirtystart = 1;
+    E.dirtyend = 0;
+    bracketInvalidate(0);
+    historyInit();
+    if (filename && !editorOpen(filename)) {
+        /* the new buffer is dropped, the message of editorOpen() stays */
+        for (int r = 0; r < E.numrows; r++)
+            editorRowFree(&E.row[r]);
+        allocFree(E.row);
+        allocFree(E.filename);
+        H.delete();
+        B.count--;
+        bufferLoad(previous);
+        return -1;
+    }
+    if (!filename) editorOpenEmpty();
+
+    windowLayout();
+    bufferBudget();
+    return 1;
+}
+
+int bufferCount(void) {
+    return B.count;
+}
+
+int bufferActive(void) {
+    return B.active;
+}
+
+/*
+ * Description:
+ * Writes the buffer names into buf, the active one in brackets and evicted ones in parentheses
+ * Returns the length written
+ */
+int bufferList(char *buf, int size) {
+    int len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < B.count && len < size; i++) {
+        const char *name = i == B.active ? E.filename : B.bufs[i].filename;
+        if (!name) name = "[No File]";
+        const char *base = strrchr(name, '/');
+        if (base && base[1]) name = base + 1;
+
+        const char *open = i == B.active ? "[" : B.bufs[i].evicted ? "(" : "";
+        const char *close = i == B.active ? "]" : B.bufs[i].evicted ? ")" : "";
+        len += snprintf(buf + len, size - len, "%s%s%d:%s%s", i ? " " : "", open, i + 1, name, close);
+    }
+    return len < size ? len : size - 1;
+}
+
+/*
+ * Description:
+ * Frees every parked buffer, the active one is freed along with E and H
+ */
+void bufferDelete(void) {
+    struct History active = H;
+    for (int i = 0; i < B.count; i++) {
+        if (i == B.active) continue;
+        struct editorBuffer *b = &B.bufs[i];
+        if (!b->evicted) {
+            for (int r = 0; r < b->numrows; r++)
+                editorRowFree(&b->row[r]);
+            allocFree(b->row);
+        }
+        allocFree(b->filename);
+        H = b->history;
+        H.delete();
+    }
+    H = active;
+
+    allocFree(B.bufs);
+    B.bufs = NULL;
+    B.count = 0;
+}
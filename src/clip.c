@@ -0,0 +1,197 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <string.h>
+#include "lib.h"
+#include "alloc.h"
+#include "types.h"
+#include "editor.h"
+#include "history.h"
+#include "clip.h"
+
+/*
+ * The selection is the text between the mark and the cursor of the active window
+ * The clipboard is a list of rows that are joined by newlines when pasted
+ * Whole rows share their chars with the rows they were taken from, only a partial first/last row is copied,
+ * so a large copy costs no memory until either side is changed
+ */
+static struct {
+    int marked;
+    int my, mx;  /* mark */
+    int drawnCy; /* cursor row in the last frame, rows it moved over are repainted */
+    erowList *rows;
+} C = {0, 0, 0, 0, NULL};
+
+/* Initialises row with the chars of a, b and c one after the other */
+static void clipRowJoin(erow *row, const char *a, size_t alen, const char *b, size_t blen, const char *c, size_t clen) {
+    size_t size = alen + blen + clen;
+    editorRowSet(row, "", 0);
+    char *chars = editorRowReserve(row, size);
+    memcpy(chars, a, alen);
+    memcpy(chars + alen, b, blen);
+    memcpy(chars + alen + blen, c, clen);
+    chars[size] = '\0';
+    row->size = size;
+}
+
+/* Mark and cursor in order, the mark is clamped as rows might have changed since it was set */
+static void clipRegion(int *y0, int *x0, int *y1, int *x1) {
+    int my = C.my < E.numrows ? C.my : E.numrows - 1;
+    int mx = C.mx < (int) E.row[my].size ? C.mx : (int) E.row[my].size;
+    if (my < E.cy || (my == E.cy && mx < E.cx)) {
+        *y0 = my, *x0 = mx, *y1 = E.cy, *x1 = E.cx;
+    } else {
+        *y0 = E.cy, *x0 = E.cx, *y1 = my, *x1 = mx;
+    }
+}
+
+/*
+ * Description:
+ * Sets the mark at the cursor, or clears it when it is set already
+ * Returns 1 when the mark is set afterwards
+ */
+int clipMark(void) {
+    if (C.marked) {
+        clipUnmark();
+        return 0;
+    }
+    C.marked = 1;
+    C.my = E.cy;
+    C.mx = E.cx;
+    C.drawnCy = E.cy;
+    return 1;
+}
+
+void clipUnmark(void) {
+    if (!C.marked) return;
+    int y0, x0, y1, x1;
+    clipRegion(&y0, &x0, &y1, &x1);
+    editorMarkDirty(y0, y1);
+    C.marked = 0;
+}
+
+/*
+ * Description:
+ * Gets the selected chars [from, to) of row at
+ * Returns 0 when no part of the row is selected
+ */
+int clipSelection(int at, int *from, int *to) {
+    if (!C.marked) return 0;
+    int y0, x0, y1, x1;
+    clipRegion(&y0, &x0, &y1, &x1);
+    if (at < y0 || at > y1) return 0;
+    *from = at == y0 ? x0 : 0;
+    *to = at == y1 ? x1 : (int) E.row[at].size;
+    return 1;
+}
+
+/*
+ * Description:
+ * Marks the rows the cursor moved over since the last frame for repainting, the selection grew or shrank there
+ */
+void clipRefresh(void) {
+    if (!C.marked) return;
+    editorMarkDirty(C.drawnCy < E.cy ? C.drawnCy : E.cy, C.drawnCy < E.cy ? E.cy : C.drawnCy);
+    C.drawnCy = E.cy;
+}
+
+/*
+ * Description:
+ * Puts the selection in the clipboard and clears the mark
+ * Returns the number of rows copied, 0 when nothing is selected
+ */
+int clipCopy(void) {
+    if (!C.marked) return 0;
+    int y0, x0, y1, x1;
+    clipRegion(&y0, &x0, &y1, &x1);
+    clipUnmark();
+    if (y0 == y1 && x0 == x1) return 0;
+
+    editorRowsFree(C.rows);
+    int count = y1 - y0 + 1;
+    C.rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    C.rows->count = count;
+    for (int i = 0; i < count; i++) {
+        erow *row = &E.row[y0 + i];
+        int from = i ? 0 : x0;
+        int to = i < count - 1 ? (int) row->size : x1;
+        if (!from && to == (int) row->size) editorRowShare(&C.rows->rows[i], row);
+        else editorRowSet(&C.rows->rows[i], ROW_CHARS(row) + from, to - from);
+    }
+    return count;
+}
+
+/*
+ * Description:
+ * Replaces rows [at, at + count) with rows, as a single history entry
+ */
+static void clipReplace(int at, int count, erowList *rows) {
+    erowReplace *rep = (erowReplace *) allocMem(ALLOC_HISTORY, sizeof(erowReplace));
+    rep->inserted = editorRowsShare(rows->rows, rows->count);
+    rep->removed = editorRowsReplace(at, count, rows);
+    Action act = {.length = 1, .ax = 0, .ay = at, .type = REPLACE_ROWS, .data = (char *) rep, .sub = NULL};
+    H.push(&act);
+}
+
+/*
+ * Description:
+ * Puts the selection in the clipboard and removes it from the buffer
+ * Returns the number of rows cut, 0 when nothing is selected
+ */
+int clipCut(void) {
+    if (!C.marked) return 0;
+    int y0, x0, y1, x1;
+    clipRegion(&y0, &x0, &y1, &x1);
+    int count = clipCopy();
+    if (!count) return 0;
+
+    /* the rows of the selection become the text before it on the first row and after it on the last */
+    const erow *first = &E.row[y0], *last = &E.row[y1];
+    erowList *rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow));
+    rows->count = 1;
+    clipRowJoin(&rows->rows[0], ROW_CHARS(first), x0, ROW_CHARS(last) + x1, last->size - x1, "", 0);
+    clipReplace(y0, count, rows);
+
+    E.cy = y0;
+    E.cx = x0;
+    return count;
+}
+
+/*
+ * Description:
+ * Inserts the clipboard at the cursor and moves the cursor after it
+ * Returns the number of rows pasted, 0 when the clipboard is empty
+ */
+int clipPaste(void) {
+    if (!C.rows) return 0;
+    clipUnmark();
+
+    int count = C.rows->count;
+    const erow *row = &E.row[E.cy];
+    const char *chars = ROW_CHARS(row);
+    size_t head = E.cx, tail = row->size - E.cx;
+    const erow *last = &C.rows->rows[count - 1];
+
+    erowList *rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    rows->count = count;
+    for (int i = 0; i < count; i++) {
+        erow *clip = &C.rows->rows[i];
+        size_t before = i ? 0 : head;
+        size_t after = i < count - 1 ? 0 : tail;
+        /* the row the clipboard is pasted into is split around it */
+        if (!before && !after) editorRowShare(&rows->rows[i], clip);
+        else clipRowJoin(&rows->rows[i], chars, before, ROW_CHARS(clip), clip->size, chars + row->size - after, after);
+    }
+    clipReplace(E.cy, 1, rows);
+
+    E.cx = (count == 1 ? head : 0) + last->size;
+    E.cy += count - 1;
+    return count;
+}
+
+void clipDelete(void) {
+    editorRowsFree(C.rows);
+    C.rows = NULL;
+    C.marked = 0;
+}
@@ -0,0 +1,244 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "types.h"
+#include "editor.h"
+#include "history.h"
+#include "filter.h"
+#include "input.h"
+
+#define FILTER_CHUNK 65536
+
+/*
+ * Rows of the range are written to the command a chunk at a time and its output is split into
+ * rows as it arrives, so neither side of the pipe is ever held in memory as a whole
+ */
+typedef struct {
+    erowList *rows;
+    int capacity;
+    char *line; /* partial last line, waiting for its newline */
+    size_t linelen, linecap;
+} FilterOutput;
+
+static void filterAppendRow(FilterOutput *out, const char *s, size_t len) {
+    if (len && s[len - 1] == '\r') len--;
+    if (out->rows->count == out->capacity) {
+        out->capacity = out->capacity ? out->capacity * 2 : 64;
+        out->rows = (erowList *) allocResize(ALLOC_ROWS, out->rows, sizeof(erowList) + sizeof(erow) * out->capacity);
+    }
+    editorRowSet(&out->rows->rows[out->rows->count++], s, len);
+}
+
+static void filterAppendLine(FilterOutput *out, const char *s, size_t len) {
+    if (out->linelen + len > out->linecap) {
+        out->linecap = (out->linelen + len) * 2;
+        out->line = (char *) allocResize(ALLOC_IO, out->line, out->linecap);
+    }
+    memcpy(out->line + out->linelen, s, len);
+    out->linelen += len;
+}
+
+/*
+ * Description:
+ * Splits buf into rows, the text after the last newline is kept until more output arrives
+ */
+static void filterConsume(FilterOutput *out, const char *buf, size_t len) {
+    const char *end = buf + len;
+    while (buf < end) {
+        const char *nl = memchr(buf, '\n', end - buf);
+        if (!nl) {
+            filterAppendLine(out, buf, end - buf);
+            return;
+        }
+        if (out->linelen) {
+            filterAppendLine(out, buf, nl - buf);
+            filterAppendRow(out, out->line, out->linelen);
+            out->linelen = 0;
+        } else {
+            filterAppendRow(out, buf, nl - buf);
+        }
+        buf = nl + 1;
+    }
+}
+
+/*
+ * Description:
+ * Fills buf with as many rows as fit, starting at *row, and returns its length
+ * A row longer than the buffer is written on its own with *rowoff tracking the part already sent
+ */
+static size_t filterFill(char *buf, int *row, size_t *rowoff, int to) {
+    size_t len = 0;
+    while (*row <= to && len < FILTER_CHUNK) {
+        erow *r = &E.row[*row];
+        size_t n = r->size + 1 - *rowoff;
+        if (n > FILTER_CHUNK - len) n = FILTER_CHUNK - len;
+
+        size_t copied = n;
+        if (*rowoff + n > r->size) copied--;
+        memcpy(buf + len, ROW_CHARS(r) + *rowoff, copied);
+        if (copied < n) buf[len + copied] = '\n';
+
+        len += n;
+        *rowoff += n;
+        if (*rowoff > r->size) {
+            (*row)++;
+            *rowoff = 0;
+        }
+    }
+    return len;
+}
+
+static int filterSpawn(const char *command, int *in, int *out) {
+    int tochild[2], fromchild[2];
+    if (pipe(tochild) == -1) return -1;
+    if (pipe(fromchild) == -1) {
+        close(tochild[0]);
+        close(tochild[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(tochild[0]);
+        close(tochild[1]);
+        close(fromchild[0]);
+        close(fromchild[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(tochild[0], STDIN_FILENO);
+        dup2(fromchild[1], STDOUT_FILENO);
+        dup2(fromchild[1], STDERR_FILENO);
+        close(tochild[0]);
+        close(tochild[1]);
+        close(fromchild[0]);
+        close(fromchild[1]);
+        signal(SIGPIPE, SIG_DFL);
+        execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+        _exit(127);
+    }
+
+    close(tochild[0]);
+    close(fromchild[1]);
+    fcntl(tochild[1], F_SETFL, fcntl(tochild[1], F_GETFL) | O_NONBLOCK);
+    fcntl(fromchild[0], F_SETFL, fcntl(fromchild[0], F_GETFL) | O_NONBLOCK);
+    *in = tochild[1];
+    *out = fromchild[0];
+    return pid;
+}
+
+/*
+ * Description:
+ * Pipes rows from..to through command and replaces them with its output as one undo entry
+ * Writing and reading run concurrently with poll() so a command that outputs before
+ * consuming all of its input can not deadlock; ESC typed meanwhile kills the command
+ * Returns the exit status of the command, or -1 if it could not be run or was cancelled
+ */
+int editorFilter(int from, int to, const char *command) {
+    int in, out;
+    pid_t pid = filterSpawn(command, &in, &out);
+    if (pid == -1) return -1;
+
+    /* A command that exits without reading its input must not take the editor down with it */
+    void (*oldpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    FilterOutput output = {0};
+    output.rows = (erowList *) allocZero(ALLOC_ROWS, sizeof(erowList));
+
+    char *wbuf = (char *) allocMem(ALLOC_IO, FILTER_CHUNK);
+    char *rbuf = (char *) allocMem(ALLOC_IO, FILTER_CHUNK);
+    size_t wlen = 0, woff = 0, rowoff = 0;
+    int row = from, cancelled = 0;
+
+    while (out != -1) {
+        if (in != -1 && woff == wlen) {
+            wlen = filterFill(wbuf, &row, &rowoff, to);
+            woff = 0;
+            if (!wlen) {
+                close(in);
+                in = -1;
+            }
+        }
+
+        struct pollfd fds[3] = {
+            {.fd = out, .events = POLLIN},
+            {.fd = in, .events = POLLOUT},
+            {.fd = inputFd(), .events = POLLIN},
+        };
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        /* other keys are held, they are handled once the filter is done */
+        if (fds[2].revents & POLLIN) {
+            if (inputEscape()) {
+                kill(pid, SIGTERM);
+                cancelled = 1;
+                break;
+            }
+        }
+
+        if (in != -1 && fds[1].revents & (POLLOUT | POLLERR | POLLHUP)) {
+            ssize_t n = write(in, wbuf + woff, wlen - woff);
+            if (n > 0) woff += n;
+            else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+                close(in);
+                in = -1;
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            ssize_t n = read(out, rbuf, FILTER_CHUNK);
+            if (n > 0) filterConsume(&output, rbuf, n);
+            else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+                close(out);
+                out = -1;
+            }
+        }
+    }
+
+    if (in != -1) close(in);
+    if (out != -1) close(out);
+    allocFree(wbuf);
+    allocFree(rbuf);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    signal(SIGPIPE, oldpipe);
+
+    if (output.linelen) filterAppendRow(&output, output.line, output.linelen);
+    allocFree(output.line);
+
+    if (cancelled) {
+        editorRowsFree(output.rows);
+        return -1;
+    }
+
+    /* The buffer always keeps at least one row */
+    if (!output.rows->count && to - from + 1 == E.numrows) filterAppendRow(&output, "", 0);
+
+    /* History shares the chars of the output with the buffer, they are copied once either side edits them */
+    erowReplace *rep = (erowReplace *) allocMem(ALLOC_HISTORY, sizeof(erowReplace));
+    rep->inserted = editorRowsShare(output.rows->rows, output.rows->count);
+    rep->removed = editorRowsReplace(from, to - from + 1, output.rows);
+    Action act = {.length = 1, .ax = 0, .ay = from, .type = REPLACE_ROWS, .data = (char *) rep, .sub = NULL};
+    H.push(&act);
+
+    E.cy = from < E.numrows ? from : E.numrows - 1;
+    E.cx = 0;
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
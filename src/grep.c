@@ -0,0 +1,424 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "history.h"
+#include "buffer.h"
+#include "grep.h"
+
+#define GREP_MAX_THREADS 64
+#define GREP_TEXT_MAX 256 /* text of a hit shown in the list, longer lines are cut */
+#define GREP_PROBE 4096   /* files with a null character in their first bytes are binary and skipped */
+
+/* A directory or file still to be looked at */
+typedef struct GrepItem {
+    struct GrepItem *next;
+    int dir;
+    char path[];
+} GrepItem;
+
+typedef struct {
+    char *b;
+    size_t len, capacity;
+} GrepText;
+
+/*
+ * Files are searched on a pool of worker threads, one per core. Directories and files wait in a single
+ * queue, a worker that takes a directory queues its entries, so the tree is walked in parallel too
+ * Every worker compiles the pattern for itself, as a compiled regex is locked while it is matched
+ * Files are mapped and matched as a whole, only the lines with a hit are looked for
+ * Hits are formatted as `path:line:column: text` and handed to the UI under lock, which appends them
+ * to the list buffer while it is the active one, and keeps them for later otherwise
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t more; /* items were queued, or the last busy worker found none left */
+    pthread_t workers[GREP_MAX_THREADS];
+    int nworkers;
+    int running; /* workers were started and not joined yet */
+    char *pattern;
+    int wake[2];
+
+    /* guarded by lock */
+    GrepItem *queue;
+    int busy;     /* workers looking at an item, new items can come from them */
+    int finished; /* workers that ran out of items */
+    int cancel;
+    GrepText hits; /* lines not in the list yet */
+    long nhits, files, matched;
+
+    int list; /* buffer of the results, -1 until the first search */
+    struct timespec start;
+} G = {.lock = PTHREAD_MUTEX_INITIALIZER, .more = PTHREAD_COND_INITIALIZER, .wake = {-1, -1}, .list = -1};
+
+static void grepAppend(GrepText *t, const char *s, size_t len) {
+    if (t->len + len + 1 > t->capacity) {
+        t->capacity = (t->len + len + 1) * 2;
+        t->b = (char *) allocResize(ALLOC_SEARCH, t->b, t->capacity);
+    }
+    memcpy(t->b + t->len, s, len);
+    t->len += len;
+    t->b[t->len] = '\0';
+}
+
+static GrepItem *grepItem(const char *dir, const char *name, int isdir) {
+    size_t dlen = dir ? strlen(dir) : 0, nlen = strlen(name);
+    GrepItem *item = (GrepItem *) allocMem(ALLOC_SEARCH, sizeof(GrepItem) + dlen + nlen + 2);
+    item->dir = isdir;
+    item->next = NULL;
+    if (dir) {
+        memcpy(item->path, dir, dlen);
+        item->path[dlen] = '/';
+        memcpy(item->path + dlen + 1, name, nlen + 1);
+    } else {
+        memcpy(item->path, name, nlen + 1);
+    }
+    return item;
+}
+
+/* Queues the entries of a directory, hidden ones and symbolic links are left out */
+static void grepDir(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    GrepItem *first = NULL, *last = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+
+        int type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG) continue;
+
+        GrepItem *item = grepItem(strcmp(path, ".") ? path : NULL, entry->d_name, type == DT_DIR);
+        if (last) last->next = item;
+        else first = item;
+        last = item;
+    }
+    closedir(dir);
+    if (!first) return;
+
+    pthread_mutex_lock(&G.lock);
+    last->next = G.queue;
+    G.queue = first;
+    pthread_cond_broadcast(&G.more);
+    pthread_mutex_unlock(&G.lock);
+}
+
+/*
+ * Description:
+ * Appends a line to out for every line of the file at path that has a match
+ * Returns 1 when there was one
+ */
+static int grepFile(regex_t *regex, const char *path, GrepText *out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !st.st_size) {
+        close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    const char *map = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+    if (memchr(map, '\0', size < GREP_PROBE ? size : GREP_PROBE)) {
+        munmap((void *) map, size);
+        return 0;
+    }
+
+    /* at is always the start of a line, lines before it were counted */
+    size_t at = 0;
+    long line = 1;
+    int found = 0;
+    while (at < size) {
+        regmatch_t m = {.rm_so = at, .rm_eo = size};
+        if (regexec(regex, map, 1, &m, REG_STARTEND)) break;
+
+        size_t start = m.rm_so;
+        const char *nl;
+        while ((nl = (const char *) memchr(map + at, '\n', start - at))) {
+            line++;
+            at = nl - map + 1;
+        }
+        nl = (const char *) memchr(map + start, '\n', size - start);
+        size_t end = nl ? (size_t) (nl - map) : size;
+
+        size_t len = end - at;
+        if (len && map[at + len - 1] == '\r') len--;
+        if (len > GREP_TEXT_MAX) len = GREP_TEXT_MAX;
+        char prefix[64];
+        int plen = snprintf(prefix, sizeof(prefix), ":%ld:%zu: ", line, start - at + 1);
+        grepAppend(out, path, strlen(path));
+        grepAppend(out, prefix, plen);
+        grepAppend(out, map + at, len);
+        grepAppend(out, "\n", 1);
+        found = 1;
+
+        at = end + 1;
+        line++;
+    }
+    munmap((void *) map, size);
+    return found;
+}
+
+static void *grepWorker(void *arg) {
+    (void) arg;
+    regex_t regex;
+    int compiled = !regcomp(&regex, G.pattern, REG_EXTENDED | REG_NEWLINE);
+    GrepText out = {NULL, 0, 0};
+
+    pthread_mutex_lock(&G.lock);
+    while (compiled) {
+        while (!G.queue && G.busy && !G.cancel) pthread_cond_wait(&G.more, &G.lock);
+        if (G.cancel || !G.queue) break;
+
+        GrepItem *item = G.queue;
+        G.queue = item->next;
+        G.busy++;
+        pthread_mutex_unlock(&G.lock);
+
+        int isdir = item->dir, found = 0;
+        if (isdir) grepDir(item->path);
+        else found = grepFile(&regex, item->path, &out);
+        allocFree(item);
+        long nhits = 0;
+        for (size_t i = 0; i < out.len; i++) nhits += out.b[i] == '\n';
+
+        pthread_mutex_lock(&G.lock);
+        G.busy--;
+        if (!isdir) G.files++;
+        if (found) {
+            G.matched++;
+            G.nhits += nhits;
+            grepAppend(&G.hits, out.b, out.len);
+            out.len = 0;
+            if (write(G.wake[1], "", 1) == -1) {} /* the pipe being full already means a wakeup */
+        }
+        if (!G.queue && !G.busy) pthread_cond_broadcast(&G.more);
+    }
+    G.finished++;
+    pthread_mutex_unlock(&G.lock);
+    if (write(G.wake[1], "", 1) == -1) {}
+
+    if (compiled) regfree(&regex);
+    allocFree(out.b);
+    return NULL;
+}
+
+static void grepStop(void) {
+    if (!G.running) return;
+    pthread_mutex_lock(&G.lock);
+    G.cancel = 1;
+    pthread_cond_broadcast(&G.more);
+    pthread_mutex_unlock(&G.lock);
+    for (int i = 0; i < G.nworkers; i++)
+        pthread_join(G.workers[i], NULL);
+
+    while (G.queue) {
+        GrepItem *item = G.queue;
+        G.queue = item->next;
+        allocFree(item);
+    }
+    allocFree(G.hits.b);
+    G.hits = (GrepText) {NULL, 0, 0};
+    allocFree(G.pattern);
+    G.pattern = NULL;
+    G.running = 0;
+}
+
+/* Moves rows to the end of the list buffer, which is the active one */
+static void grepAddRows(const char *text, size_t len) {
+    int count = 0;
+    for (size_t i = 0; i < len; i++) count += text[i] == '\n';
+    if (!count) return;
+
+    erowList *rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    rows->count = count;
+    const char *line = text;
+    for (int i = 0; i < count; i++) {
+        const char *nl = (const char *) memchr(line, '\n', text + len - line);
+        editorRowSet(&rows->rows[i], line, nl - line);
+        line = nl + 1;
+    }
+    editorRowsLock();
+    editorRowsFree(editorRowsReplace(E.numrows, 0, rows));
+    editorRowsUnlock();
+}
+
+static int grepPending(int *fd, int *timeout) {
+    if (!G.running) return 0;
+    *fd = G.wake[0];
+
+    pthread_mutex_lock(&G.lock);
+    int ready = G.hits.len || G.finished == G.nworkers;
+    pthread_mutex_unlock(&G.lock);
+    /* hits wait while another buffer is active, they are added once the list is switched to */
+    *timeout = ready && bufferActive() == G.list ? 0 : -1;
+    return 1;
+}
+
+/*
+ * Description:
+ * Adds the hits found since the last call to the list, and a summary once every worker is done
+ */
+static int grepCollect(long budget) {
+    (void) budget;
+    char buf[64];
+    while (read(G.wake[0], buf, sizeof(buf)) > 0)
+        ;
+    if (bufferActive() != G.list) return 0;
+
+    pthread_mutex_lock(&G.lock);
+    GrepText hits = G.hits;
+    G.hits = (GrepText) {NULL, 0, 0};
+    int done = G.finished == G.nworkers;
+    long nhits = G.nhits, files = G.files, matched = G.matched;
+    pthread_mutex_unlock(&G.lock);
+
+    grepAddRows(hits.b, hits.len);
+    allocFree(hits.b);
+    if (done) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double ms = (now.tv_sec - G.start.tv_sec) * 1e3 + (now.tv_nsec - G.start.tv_nsec) / 1e6;
+        char summary[128];
+        int len = snprintf(summary, sizeof(summary), "%ld hits in %ld of %ld files, %d threads, %.0fms\n",
+                           nhits, matched, files, G.nworkers, ms);
+        grepAddRows(summary, len);
+        grepStop();
+    }
+    return 1;
+}
+
+const IdleTask grepTask = {"grep", grepPending, grepCollect, NULL};
+
+/*
+ * Description:
+ * Searches every file under the working directory for a regex (POSIX extended) on a thread per core
+ * Hits stream into a list buffer, ENTER on one of them opens its file at the hit
+ */
+void editorGrep(void) {
+    char *pattern = editorPrompt("Search files (regex): ", S.maxMsgSize, NULL);
+    if (!pattern) return;
+    regex_t regex;
+    if (!pattern[0] || regcomp(&regex, pattern, REG_EXTENDED | REG_NEWLINE)) {
+        editorSetMessage(pattern[0] ? "Invalid pattern" : "No pattern given");
+        allocFree(pattern);
+        return;
+    }
+    regfree(&regex);
+
+    int opened = G.list >= 0 ? bufferSwitch(G.list) : bufferOpen(NULL);
+    if (!opened) {
+        editorSetMessage("Wait for stdin to be read before searching files");
+        allocFree(pattern);
+        return;
+    }
+    G.list = bufferActive();
+    grepStop();
+
+    if (G.wake[0] == -1) {
+        if (pipe(G.wake) == -1) die("In function: %s\r\nAt line: %d\r\npipe", __func__, __LINE__);
+        fcntl(G.wake[0], F_SETFL, fcntl(G.wake[0], F_GETFL) | O_NONBLOCK);
+        fcntl(G.wake[1], F_SETFL, fcntl(G.wake[1], F_GETFL) | O_NONBLOCK);
+        fcntl(G.wake[0], F_SETFD, FD_CLOEXEC);
+        fcntl(G.wake[1], F_SETFD, FD_CLOEXEC);
+    }
+
+    /* the list starts over, along with its history */
+    char cwd[PATH_MAX], header[PATH_MAX + 128];
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, ".");
+    int len = snprintf(header, sizeof(header), "Search for %s in %s\n", pattern, cwd);
+    if (len >= (int) sizeof(header)) len = sizeof(header) - 1;
+    erowList *none = (erowList *) allocZero(ALLOC_ROWS, sizeof(erowList));
+    editorRowsLock();
+    editorRowsFree(editorRowsReplace(0, E.numrows, none));
+    editorRowsUnlock();
+    grepAddRows(header, len);
+    E.cx = E.cy = E.rx = E.max_rx = 0;
+    E.rowoff = E.rowsub = E.coloff = 0;
+    H.delete();
+    historyInit();
+
+    G.pattern = pattern;
+    G.queue = grepItem(NULL, ".", 1);
+    G.busy = G.finished = G.cancel = 0;
+    G.nhits = G.files = G.matched = 0;
+    clock_gettime(CLOCK_MONOTONIC, &G.start);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    G.nworkers = cores < 1 ? 1 : cores > GREP_MAX_THREADS ? GREP_MAX_THREADS : (int) cores;
+    for (int i = 0; i < G.nworkers; i++) {
+        if (pthread_create(&G.workers[i], NULL, grepWorker, NULL))
+            die("In function: %s\r\nAt line: %d\r\npthread_create", __func__, __LINE__);
+    }
+    G.running = 1;
+}
+
+/*
+ * Description:
+ * Opens the file of the hit on the cursor row of the list buffer, at the hit
+ * Returns 0 when the list is not the active buffer or the row is not a hit
+ */
+int grepVisit(void) {
+    if (G.list < 0 || bufferActive() != G.list || E.cy >= E.numrows) return 0;
+    const char *chars = ROW_CHARS(&E.row[E.cy]);
+
+    /* the path ends at the first `:line:column: ` */
+    const char *sep = chars;
+    long line = 0, col = 0;
+    while ((sep = strchr(sep, ':'))) {
+        char *end;
+        line = strtol(sep + 1, &end, 10);
+        if (end > sep + 1 && *end == ':') {
+            char *colend;
+            col = strtol(end + 1, &colend, 10);
+            if (colend > end + 1 && colend[0] == ':' && colend[1] == ' ' && sep > chars) break;
+        }
+        sep++;
+    }
+    if (!sep) return 0;
+
+    size_t plen = sep - chars;
+    char *path = (char *) allocMem(ALLOC_IO, plen + 1);
+    memcpy(path, chars, plen);
+    path[plen] = '\0';
+    int opened = bufferOpen(path);
+    allocFree(path);
+    if (opened < 0) return 1;
+    if (!opened) {
+        editorSetMessage("Wait for stdin to be read before opening files");
+        return 1;
+    }
+
+    E.cy = line < 1 ? 0 : line - 1 < E.numrows ? (int) line - 1 : E.numrows - 1;
+    E.cx = col < 1 ? 0 : col - 1 < (long) E.row[E.cy].size ? (int) col - 1 : (int) E.row[E.cy].size;
+    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    E.max_rx = E.rx;
+    return 1;
+}
+
+void grepDelete(void) {
+    grepStop();
+}
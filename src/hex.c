@@ -0,0 +1,405 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "hex.h"
+
+/*** defines ***/
+#define HEX_DETECT_SIZE 8192 /* bytes looked at to tell binary files from text */
+#define HEX_MAX_PER_ROW 32
+#define HEX_LINE_SIZE 1024
+
+/*** data ***/
+/* a byte overwritten in the view, but not written to the file yet */
+typedef struct {
+    size_t off;
+    unsigned char value;
+} HexEdit;
+
+/*
+ * The file is mapped read only and shown as offset/hex/text columns, only the rows in view are ever touched
+ * Overwritten bytes are kept aside until saved, then written back with pwrite(), the shared mapping sees them
+ */
+static struct {
+    int active;
+    int fd;
+    int writable;
+    const unsigned char *map; /* NULL for empty files */
+    size_t size;
+    char *filename;
+
+    size_t cursor;  /* offset of the byte under the cursor */
+    size_t top;     /* first row in view */
+    int nibble;     /* the next hex digit goes to the low half of the byte */
+    int text;       /* cursor is in the text column, typed characters replace bytes as they are */
+    int width;      /* digits of offsets */
+    int perRow;     /* bytes shown per row, fitted to the terminal */
+
+    HexEdit *edits; /* sorted by offset */
+    int nedits, capacity;
+    int dropWarned; /* closing was refused once because of unwritten bytes */
+} X = {0, -1, 0, NULL, 0, NULL, 0, 0, 0, 0, 8, 16, NULL, 0, 0, 0};
+
+/* two hex digits and the text column character of every byte value */
+static char hexPairs[256][2];
+static char hexText[256];
+
+static void hexTables(void) {
+    const char *digits = "0123456789abcdef";
+    for (int i = 0; i < 256; i++) {
+        hexPairs[i][0] = digits[i >> 4];
+        hexPairs[i][1] = digits[i & 0xf];
+        hexText[i] = isprint(i) ? (char) i : '.';
+    }
+}
+
+/*** edits ***/
+/* Returns the index of the first edit at or after off */
+static int hexEditFind(size_t off) {
+    int lo = 0, hi = X.nedits;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (X.edits[mid].off < off) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static unsigned char hexByte(size_t off) {
+    int i = hexEditFind(off);
+    return i < X.nedits && X.edits[i].off == off ? X.edits[i].value : X.map[off];
+}
+
+/* Overwrites the byte at off, putting back the byte of the file forgets the edit */
+static void hexSet(size_t off, unsigned char value) {
+    int i = hexEditFind(off);
+    int exists = i < X.nedits && X.edits[i].off == off;
+
+    if (value == X.map[off]) {
+        if (exists) {
+            memmove(&X.edits[i], &X.edits[i + 1], sizeof(HexEdit) * (X.nedits - i - 1));
+            X.nedits--;
+        }
+        return;
+    }
+    if (exists) {
+        X.edits[i].value = value;
+        return;
+    }
+
+    if (X.nedits == X.capacity) {
+        X.capacity = X.capacity ? 2 * X.capacity : 16;
+        X.edits = (HexEdit *) allocResize(ALLOC_IO, X.edits, sizeof(HexEdit) * X.capacity);
+    }
+    memmove(&X.edits[i + 1], &X.edits[i], sizeof(HexEdit) * (X.nedits - i));
+    X.edits[i] = (HexEdit) {off, value};
+    X.nedits++;
+}
+
+/*** file ***/
+/*
+ * Description:
+ * Tells whether filename looks binary, i.e. it has a null byte in its first HEX_DETECT_SIZE bytes
+ */
+int hexDetect(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return 0;
+
+    char buf[HEX_DETECT_SIZE];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 && memchr(buf, '\0', n) != NULL;
+}
+
+/*
+ * Description:
+ * Shows filename in the hex view, read only if it can not be opened for writing
+ * Returns 0 if the file can not be opened or mapped
+ */
+int hexOpen(const char *filename) {
+    if (X.active) return 0;
+
+    int writable = 1;
+    int fd = open(filename, O_RDWR);
+    if (fd == -1) {
+        writable = 0;
+        fd = open(filename, O_RDONLY);
+    }
+    if (fd == -1) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+
+    const unsigned char *map = NULL;
+    if (st.st_size > 0) {
+        map = (const unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return 0;
+        }
+    }
+
+    if (!hexPairs[0][0]) hexTables();
+    X.active = 1;
+    X.fd = fd;
+    X.writable = writable;
+    X.map = map;
+    X.size = st.st_size;
+    X.filename = allocString(ALLOC_IO, filename);
+    X.cursor = X.top = 0;
+    X.nibble = X.text = 0;
+    X.width = X.size > 0xffffffffu ? 12 : 8;
+    X.nedits = 0;
+    X.dropWarned = 0;
+    return 1;
+}
+
+/*
+ * Description:
+ * Leaves the hex view
+ * Returns 0 the first time it is called with unwritten bytes, the second call or force drops them
+ */
+int hexClose(int force) {
+    if (!X.active) return 1;
+    if (X.nedits && !X.dropWarned && !force) {
+        X.dropWarned = 1;
+        return 0;
+    }
+
+    if (X.map) munmap((void *) X.map, X.size);
+    close(X.fd);
+    allocFree(X.filename);
+    allocFree(X.edits);
+    X.map = NULL;
+    X.fd = -1;
+    X.filename = NULL;
+    X.edits = NULL;
+    X.nedits = X.capacity = 0;
+    X.active = 0;
+    return 1;
+}
+
+int hexActive(void) {
+    return X.active;
+}
+
+/*
+ * Description:
+ * Writes overwritten bytes to the file, runs of adjacent bytes with a single pwrite()
+ * Returns the number of bytes written, -1 on failure or for read only files, the edits are kept then
+ */
+int hexSave(void) {
+    if (!X.writable) return -1;
+
+    int written = 0;
+    unsigned char run[256];
+    for (int i = 0; i < X.nedits;) {
+        int n = 0;
+        size_t off = X.edits[i].off;
+        while (i + n < X.nedits && n < (int) sizeof(run) && X.edits[i + n].off == off + n) {
+            run[n] = X.edits[i + n].value;
+            n++;
+        }
+        if (pwrite(X.fd, run, n, off) != n) {
+            memmove(X.edits, &X.edits[i], sizeof(HexEdit) * (X.nedits - i));
+            X.nedits -= i;
+            return -1;
+        }
+        written += n;
+        i += n;
+    }
+    X.nedits = 0;
+    X.dropWarned = 0;
+    return written;
+}
+
+/*** view ***/
+/* Fits as many bytes in a row as the terminal allows, a multiple of 8 when there is room */
+static void hexLayout(void) {
+    int n = (E.termcols - X.width - 3) / 4;
+    if (n >= 8) n -= n % 8;
+    if (n > HEX_MAX_PER_ROW) n = HEX_MAX_PER_ROW;
+    if (n < 1) n = 1;
+    X.perRow = n;
+}
+
+static void hexScroll(void) {
+    size_t rows = E.termrows > 2 ? E.termrows - 2 : 1;
+    size_t row = X.cursor / X.perRow;
+    if (row < X.top) X.top = row;
+    if (row >= X.top + rows) X.top = row - rows + 1;
+}
+
+int hexGoto(size_t offset) {
+    if (offset >= X.size) return 0;
+    X.cursor = offset;
+    X.nibble = 0;
+    return 1;
+}
+
+void hexProcessKey(int c) {
+    X.dropWarned = 0;
+    hexLayout();
+    size_t per = X.perRow;
+    size_t page = per * (E.termrows > 3 ? E.termrows - 3 : 1);
+    size_t last = X.size ? X.size - 1 : 0;
+
+    switch (c) {
+        case ARROW_LEFT:
+            if (X.cursor > 0) X.cursor--;
+            X.nibble = 0;
+            break;
+        case ARROW_RIGHT:
+            if (X.cursor < last) X.cursor++;
+            X.nibble = 0;
+            break;
+        case ARROW_UP:
+            if (X.cursor >= per) X.cursor -= per;
+            X.nibble = 0;
+            break;
+        case ARROW_DOWN:
+            if (X.cursor + per <= last) X.cursor += per;
+            X.nibble = 0;
+            break;
+        case PAGE_UP:
+            X.cursor = X.cursor >= page ? X.cursor - page : X.cursor % per;
+            X.nibble = 0;
+            break;
+        case PAGE_DOWN:
+            while (X.cursor + per <= last && page) {
+                X.cursor += per;
+                page -= per;
+            }
+            X.nibble = 0;
+            break;
+        case HOME_KEY:
+            X.cursor -= X.cursor % per;
+            X.nibble = 0;
+            break;
+        case END_KEY:
+            X.cursor = X.cursor - X.cursor % per + per - 1;
+            if (X.cursor > last) X.cursor = last;
+            X.nibble = 0;
+            break;
+        case '\t':
+            X.text = !X.text;
+            X.nibble = 0;
+            break;
+        default: {
+            int isHex = !X.text && c < 128 && isxdigit(c);
+            int isText = X.text && c < 128 && isprint(c);
+            if (!X.size || !(isHex || isText)) break;
+            if (!X.writable) {
+                editorSetMessage("%s is read only", X.filename);
+                break;
+            }
+
+            if (isText) {
+                hexSet(X.cursor, (unsigned char) c);
+            } else {
+                unsigned char v = isdigit(c) ? c - '0' : tolower(c) - 'a' + 10;
+                unsigned char b = hexByte(X.cursor);
+                hexSet(X.cursor, X.nibble ? (b & 0xf0) | v : (v << 4) | (b & 0x0f));
+                X.nibble = !X.nibble;
+                if (X.nibble) break;
+            }
+            if (X.cursor < last) X.cursor++;
+            break;
+        }
+    }
+}
+
+/*
+ * Description:
+ * Draws the rows in view over the whole text area, bytes come from the mapping through the lookup tables
+ * Unwritten bytes are shown inverted
+ */
+void hexDrawRows(struct abuf *ab) {
+    hexLayout();
+    hexScroll();
+
+    int rows = E.termrows - 2;
+    for (int y = 0; y < rows; y++) {
+        char line[HEX_LINE_SIZE];
+        int len = snprintf(line, sizeof(line), "\x1b[%d;1H", y + 1);
+        size_t off = (X.top + y) * X.perRow;
+
+        if (off >= X.size && (off || y)) {
+            line[len++] = '~';
+        } else {
+            len += snprintf(line + len, sizeof(line) - len, "%0*zx  ", X.width, off);
+            int n = X.size - off < (size_t) X.perRow ? (int) (X.size - off) : X.perRow;
+            int e = hexEditFind(off);
+
+            char text[HEX_LINE_SIZE / 2];
+            int tlen = 0;
+            for (int i = 0; i < X.perRow; i++) {
+                if (i >= n) {
+                    memcpy(line + len, "   ", 3);
+                    len += 3;
+                    continue;
+                }
+
+                int edited = e < X.nedits && X.edits[e].off == off + i;
+                unsigned char b = edited ? X.edits[e++].value : X.map[off + i];
+                if (edited) {
+                    memcpy(line + len, "\x1b[7m", 4);
+                    memcpy(text + tlen, "\x1b[7m", 4);
+                    len += 4;
+                    tlen += 4;
+                }
+                line[len++] = hexPairs[b][0];
+                line[len++] = hexPairs[b][1];
+                text[tlen++] = hexText[b];
+                if (edited) {
+                    memcpy(line + len, "\x1b[m", 3);
+                    memcpy(text + tlen, "\x1b[m", 3);
+                    len += 3;
+                    tlen += 3;
+                }
+                line[len++] = ' ';
+            }
+            line[len++] = ' ';
+            memcpy(line + len, text, tlen);
+            len += tlen;
+        }
+
+        memcpy(line + len, "\x1b[K", 3);
+        len += 3;
+        abAppend(ab, line, len);
+    }
+}
+
+int hexStatus(char *buf, int size) {
+    int len = snprintf(buf, size, "%.*s - %zu bytes (hex%s)", S.maxFileNameSize, X.filename, X.size,
+                       X.writable ? "" : ", read only");
+    if (len < size && X.nedits)
+        len += snprintf(buf + len, size - len, " [%d unwritten]", X.nedits);
+    return len < size ? len : size - 1;
+}
+
+size_t hexOffset(void) {
+    return X.cursor;
+}
+
+/* Returns the screen position of the cursor, 0 indexed */
+void hexCursor(int *y, int *x) {
+    size_t col = X.cursor % X.perRow;
+    *y = (int) (X.cursor / X.perRow - X.top);
+    if (X.text) *x = X.width + 2 + 3 * X.perRow + 1 + col;
+    else *x = X.width + 2 + 3 * col + X.nibble;
+}
@@ -1,68 +1,242 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
 #include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include "lib.h"
+#include "alloc.h"
 #include "types.h"
 #include "editor.h"
 #include "stack.h"
+#include "undotree.h"
 #include "history.h"
+#include "replace.h"
+
+#define CHECKPOINT_ROWS_PER_EDIT 64 /* a checkpoint is not taken before an edit per that many rows of the buffer */
+#define CHECKPOINT_MIN_WALK 32      /* jumps shorter than that just replay the edits */
+
+/*
+ * Description:
+ * Turns act into its inverse without touching the buffer
+ */
+static void historyFlip(Action *act) {
+    switch (act->type) {
+        case INSERT_CHAR_BEF:
+            actionTypeConv(act, REMOVE_CHAR_BEF);
+            actionAppend(act, "", 0, act->length, 0);
+            break;
+        case REMOVE_CHAR_BEF:
+            actionTypeConv(act, INSERT_CHAR_BEF);
+            actionAppend(act, "", 0, -act->length, 0);
+            break;
+        case INSERT_CHAR_AFT:
+            actionTypeConv(act, REMOVE_CHAR_AFT);
+            break;
+        case REMOVE_CHAR_AFT:
+            actionTypeConv(act, INSERT_CHAR_AFT);
+            break;
+        case INSERT_LINE_BEF:
+            actionTypeConv(act, REMOVE_LINE_BEF);
+            actionAppend(act, "", 0, 0, 1);
+            break;
+        case REMOVE_LINE_BEF:
+            actionTypeConv(act, INSERT_LINE_BEF);
+            actionAppend(act, "", 0, 0, -1);
+            break;
+        case INSERT_LINE_AFT:
+            actionTypeConv(act, REMOVE_LINE_AFT);
+            break;
+        case REMOVE_LINE_AFT:
+            actionTypeConv(act, INSERT_LINE_AFT);
+            break;
+        case REPLACE_TEXT:
+            replaceInvert(act);
+            break;
+        case REPLACE_ROWS: {
+            erowReplace *rep = (erowReplace *) act->data;
+            erowList *rows = rep->removed;
+            rep->removed = rep->inserted;
+            rep->inserted = rows;
+            break;
+        }
+        case ACTION_GROUP:
+            /* the inverse of a group is the inverse of its children, last to first */
+            for (ssize_t i = 0; i < act->length; i++)
+                historyFlip(&act->sub[i]);
+            for (ssize_t i = 0, j = act->length - 1; i < j; i++, j--) {
+                Action tmp = act->sub[i];
+                act->sub[i] = act->sub[j];
+                act->sub[j] = tmp;
+            }
+            break;
+    }
+}
 
+/*
+ * Description:
+ * Undoes act on the buffer and turns it into its inverse, so performing it again redoes it
+ */
 static void historyPerform(Action *act) {
     switch (act->type) {
         case INSERT_CHAR_BEF:
             editorRemoveChars(act->ay, act->ax + act->length, act->length);
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, REMOVE_CHAR_BEF);
-            actionAppend(act, "", 0, act->length, 0);
             break;
         case REMOVE_CHAR_BEF:
             editorRowInsertCharBefore(act->ay, act->ax - act->length, act->data, act->length);
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, INSERT_CHAR_BEF);
-            actionAppend(act, "", 0, -act->length, 0);
             break;
         case INSERT_CHAR_AFT:
             editorRemoveChars(act->ay, act->ax, (-1 * act->length));
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, REMOVE_CHAR_AFT);
             break;
         case REMOVE_CHAR_AFT:
             editorRowInsertCharAfter(act->ay, act->ax, act->data, act->length);
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, INSERT_CHAR_AFT);
             break;
         case INSERT_LINE_BEF:
             editorRemoveChars(act->ay + 1, 0, 1);
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, REMOVE_LINE_BEF);
-            actionAppend(act, "", 0, 0, 1);
             break;
         case REMOVE_LINE_BEF:
             editorRowInsertBefore(act->ay - 1, act->ax);
             E.cx = 0;
             E.cy = act->ay;
-            actionTypeConv(act, INSERT_LINE_BEF);
-            actionAppend(act, "", 0, 0, -1);
             break;
         case INSERT_LINE_AFT:
             editorRemoveChars(act->ay, act->ax, -1);
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, REMOVE_LINE_AFT);
             break;
         case REMOVE_LINE_AFT:
             editorRowInsertAfter(act->ay, act->ax);
             E.cx = act->ax;
             E.cy = act->ay;
-            actionTypeConv(act, INSERT_LINE_AFT);
             break;
+        case REPLACE_TEXT:
+            replacePerform(act); /* inverts before applying */
+            return;
+        case REPLACE_ROWS: {
+            erowReplace *rep = (erowReplace *) act->data;
+            erowList *rows = editorRowsShare(rep->removed->rows, rep->removed->count);
+            editorRowsFree(editorRowsReplace(act->ay, rep->inserted->count, rows));
+            E.cy = act->ay < E.numrows ? act->ay : E.numrows - 1;
+            E.cx = 0;
+            break;
+        }
+        case ACTION_GROUP:
+            /* undo children last to first, then reverse them so the inverse group replays in order */
+            for (ssize_t i = act->length - 1; i >= 0; i--)
+                historyPerform(&act->sub[i]);
+            for (ssize_t i = 0, j = act->length - 1; i < j; i++, j--) {
+                Action tmp = act->sub[i];
+                act->sub[i] = act->sub[j];
+                act->sub[j] = tmp;
+            }
+            return;
+    }
+    historyFlip(act);
+}
+
+/*** checkpoints ***/
+
+/*
+ * Description:
+ * Keeps a copy of the buffer at the current state, dropping the oldest checkpoint when there are too many
+ */
+static void historyCheckpoint(void) {
+    UndoNode *oldest = NULL;
+    int count = 0;
+    for (UndoNode *node = H.root; node; node = treeNext(node, H.root)) {
+        if (!node->checkpoint) continue;
+        count++;
+        if (!oldest || node->seq < oldest->seq) oldest = node;
+    }
+    if (count >= S.maxCheckpoints && oldest) {
+        checkpointDelete(oldest->checkpoint);
+        oldest->checkpoint = NULL;
     }
+
+    Checkpoint *cp = (Checkpoint *) allocMem(ALLOC_HISTORY, sizeof(Checkpoint));
+    cp->rows = editorRowsCopy(E.row, E.numrows);
+    cp->cx = E.cx;
+    cp->cy = E.cy;
+    H.current->checkpoint = cp;
+    H.sinceCheckpoint = 0;
+}
+
+/*
+ * Description:
+ * Puts the buffer in the state of node from its checkpoint
+ * Actions between the old and the new state are only inverted, none of them is performed
+ */
+static void historyRestore(UndoNode *node) {
+    UndoNode *top = treeCommonAncestor(H.current, node);
+    for (UndoNode *n = H.current; n != top; n = n->parent)
+        historyFlip(&n->action);
+    for (UndoNode *n = node; n != top; n = n->parent) {
+        historyFlip(&n->action);
+        n->parent->redo = n;
+    }
+
+    const Checkpoint *cp = node->checkpoint;
+    editorRowsFree(editorRowsReplace(0, E.numrows, editorRowsCopy(cp->rows->rows, cp->rows->count)));
+    E.cx = cp->cx;
+    E.cy = cp->cy;
+    H.current = node;
+}
+
+/*
+ * Description:
+ * Takes a checkpoint once enough edits were added since the last one
+ * Called between key presses, edits are recorded before they are applied so only then is the buffer
+ * known to be in the current state
+ */
+static void historySync(void) {
+    if (!actionIsEmpty(&H.action) || H.grouping || H.current->checkpoint) return;
+    if (H.sinceCheckpoint >= S.checkpointInterval &&
+        H.sinceCheckpoint * CHECKPOINT_ROWS_PER_EDIT >= (size_t) E.numrows)
+        historyCheckpoint();
+}
+
+/*** tree navigation ***/
+
+/* Adds act as an edit from the current state, or to the open group while grouping */
+static void historyPush(Action *act) {
+    if (actionIsEmpty(act)) return;
+    if (H.grouping) {
+        actionGroupAppend(&H.group, act);
+        return;
+    }
+
+    H.current = treeAdd(H.current, act, ++H.seq);
+    H.count++;
+
+    /* The oldest edits go first, along with the branches that split off before them */
+    while (H.count > S.maxHistory) {
+        UndoNode *keep = H.current;
+        while (keep->parent != H.root) keep = keep->parent;
+
+        while (H.root->child != keep || keep->next)
+            H.count -= treeDelete(H.root->child != keep ? H.root->child : keep->next);
+
+        actionFlush(&keep->action);
+        keep->parent = NULL;
+        checkpointDelete(H.root->checkpoint);
+        allocFree(H.root);
+        H.root = keep;
+        H.count--;
+    }
+
+    H.sinceCheckpoint++;
 }
 
 static void historyCommit(void) {
@@ -71,7 +245,7 @@ static void historyCommit(void) {
         strRev(H.action.data);
     }
 
-    actionCommit(&H.action, H.undoStack);
+    historyPush(&H.action);
 }
 
 static void editorUndo(void) {
@@ -79,45 +253,137 @@ static void editorUndo(void) {
         historyCommit();
     }
 
-    Action *act = actionPop(H.undoStack);
-    if (!act) {
+    if (H.grouping) {
+        /* while grouping, edits of the open group are undone and dropped */
+        Action *act = actionGroupPop(&H.group);
+        if (!act) return;
+        historyPerform(act);
+        actionDelete(act);
         return;
     }
 
-    historyPerform(act);
-    actionCommit(act, H.redoStack);
-    actionDelete(act);
-}
+    if (H.current == H.root) return;
 
-void historyFlushRedo(void) {
-    stackClear(H.redoStack);
+    historyPerform(&H.current->action);
+    H.current->parent->redo = H.current;
+    H.current = H.current->parent;
 }
 
 static void editorRedo(void) {
-    if (H.action.length) {
-        historyFlushRedo();
-        return;
+    /* the pending edit is the newest state, there is nothing after it */
+    if (!actionIsEmpty(&H.action) || H.grouping || !H.current->redo) return;
+
+    H.current = H.current->redo;
+    historyPerform(&H.current->action);
+}
+
+/*
+ * Description:
+ * Brings the buffer to the state of target, restoring the nearest checkpoint on the way when
+ * that saves replaying most of the edits between the two states
+ */
+static void historyJump(UndoNode *target) {
+    UndoNode *top = treeCommonAncestor(H.current, target);
+    int walk = H.current->depth + target->depth - 2 * top->depth;
+
+    UndoNode *cp = target;
+    while (cp && !cp->checkpoint) cp = cp->parent;
+    if (cp && walk > CHECKPOINT_MIN_WALK && target->depth - cp->depth < walk) {
+        historyRestore(cp);
+        top = cp;
     }
 
-    Action *act = actionPop(H.redoStack);
-    if (!act) {
-        return;
+    while (H.current != top)
+        editorUndo();
+    for (UndoNode *n = target; n != top; n = n->parent)
+        n->parent->redo = n;
+    while (H.current != target)
+        editorRedo();
+}
+
+/*
+ * Description:
+ * Goes to the state the buffer was in at `when`, that is the newest one created by then
+ * Returns the number of that state, 0 being the oldest one kept
+ */
+static long historyTravel(time_t when) {
+    historyCommit();
+    if (H.grouping) return -1;
+
+    UndoNode *target = H.root;
+    for (UndoNode *node = H.root; node; node = treeNext(node, H.root)) {
+        if (node->time <= when && node->seq > target->seq) target = node;
     }
 
-    historyPerform(act);
-    actionCommit(act, H.undoStack);
-    actionDelete(act);
+    historyJump(target);
+    return target == H.root ? 0 : target->seq;
+}
+
+/*
+ * Description:
+ * Makes redo follow the next branch from the current state
+ * Returns the 1-based position of that branch, and the number of branches in count
+ */
+static int historyBranch(int *count) {
+    historyCommit();
+
+    *count = 0;
+    int nth = 0;
+    for (UndoNode *child = H.current->child; child; child = child->next) {
+        (*count)++;
+        if (child == H.current->redo) nth = *count;
+    }
+    if (!*count) return 0;
+
+    UndoNode *next = H.current->redo ? H.current->redo->next : NULL;
+    H.current->redo = next ? next : H.current->child;
+    return next ? nth + 1 : 1;
+}
+
+/*
+ * Description:
+ * Pushes an action that was built by the caller (instead of being recorded keystroke by keystroke)
+ * The history takes over the data owned by act
+ */
+static void historyPushAction(Action *act) {
+    historyCommit();
+    historyPush(act);
+}
+
+/*
+ * Description:
+ * Every action recorded until the matching end() is undone/redone as a single step
+ * Calls can be nested, only the outermost pair creates the group
+ */
+static void historyBegin(void) {
+    historyCommit();
+    H.grouping++;
+}
+
+static void historyEnd(void) {
+    if (!H.grouping) return;
+    historyCommit();
+    if (--H.grouping) return;
+
+    if (H.group.length == 1) {
+        /* a group of one is just that action */
+        Action *act = actionGroupPop(&H.group);
+        historyPush(act);
+        actionDelete(act);
+    } else {
+        historyPush(&H.group);
+    }
 }
 
 static void historyDelete(void) {
-    stackDelete(H.undoStack);
-    stackDelete(H.redoStack);
+    treeDelete(H.root);
     if (!actionIsEmpty(&H.action)) actionFlush(&H.action);
+    if (!actionIsEmpty(&H.group)) actionFlush(&H.group);
 }
 
 /*
  * Description:
- * This function records every action that takes place in the editor and appends to Undo stack
+ * This function records every action that takes place in the editor and adds it to the undo tree
  *
  * type => is the type of operation just performed
  * data => the character(s) that is just appended or deleted
@@ -140,8 +406,6 @@ static void historyRecord(const ActionType type, const char *data, const ssize_t
         }
     }
 
-    historyFlushRedo();
-
     switch (type) {
         case INSERT_LINE_BEF:
         case INSERT_LINE_AFT:
@@ -158,6 +422,9 @@ static void historyRecord(const ActionType type, const char *data, const ssize_t
             break;
 
         case INSERT_CHAR_AFT:
+        case REPLACE_TEXT:
+        case REPLACE_ROWS:
+        case ACTION_GROUP:
             break;
 
         case INSERT_CHAR_BEF:
@@ -186,13 +453,24 @@ static void historyRecord(const ActionType type, const char *data, const ssize_t
 }
 
 void historyInit(void) {
-    H.undoStack = stackInit();
-    H.redoStack = stackInit();
-    H.action = (Action) {.length = 0, .ax = 0, .ay = 0, .data = NULL};
+    Action none = {.length = 0, .data = NULL, .sub = NULL};
+    H.root = H.current = treeAdd(NULL, &none, 0);
+    H.count = 0;
+    H.seq = 0;
+    H.sinceCheckpoint = 0;
+    H.action = (Action) {.length = 0, .ax = 0, .ay = 0, .data = NULL, .sub = NULL};
+    H.group = (Action) {.length = 0, .ax = 0, .ay = 0, .type = ACTION_GROUP, .data = NULL, .sub = NULL};
+    H.grouping = 0;
     H.time = time(NULL);
     H.undo = editorUndo;
     H.redo = editorRedo;
     H.record = historyRecord;
     H.commit = historyCommit;
+    H.push = historyPushAction;
+    H.begin = historyBegin;
+    H.end = historyEnd;
+    H.travel = historyTravel;
+    H.branch = historyBranch;
+    H.sync = historySync;
     H.delete = historyDelete;
 }
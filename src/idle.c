@@ -0,0 +1,143 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include "lib.h"
+#include "alloc.h"
+#include "idle.h"
+
+#define IDLE_MAX_TASKS 8
+#define IDLE_SLICE_NS 1000000   /* a task runs this long before input is checked again */
+#define IDLE_FRAME_NS 16000000  /* while tasks keep changing the screen, it is redrawn this often */
+
+/*
+ * Tasks take turns in slices, the first one after the task that ran last goes first
+ * Time is accounted on the UI thread's CPU clock, work a task hands to threads of its own is not included
+ */
+static struct {
+    struct {
+        const IdleTask *task;
+        struct timespec ran; /* end of the last step, timeouts count from there */
+        long cpu;            /* CPU time spent in steps */
+        long longest;        /* longest step, slices can run over when a task can not split its work */
+        long steps;
+    } tasks[IDLE_MAX_TASKS];
+    int count;
+    int next;
+} I = {.count = 0, .next = 0};
+
+static long idleElapsed(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+void idleAdd(const IdleTask *task) {
+    if (I.count == IDLE_MAX_TASKS) die("In function: %s\r\nAt line: %d\r\nToo many idle tasks", __func__, __LINE__);
+    I.tasks[I.count].task = task;
+    clock_gettime(CLOCK_MONOTONIC, &I.tasks[I.count].ran);
+    I.count++;
+}
+
+static int idleInput(int input) {
+    struct pollfd fd = {.fd = input, .events = POLLIN};
+    return poll(&fd, 1, 0) > 0 && fd.revents & (POLLIN | POLLHUP);
+}
+
+/*
+ * Description:
+ * Runs the tasks that have work in slices of IDLE_SLICE_NS, checking for input on `input` between slices
+ * Returns 1 when tasks changed the screen, at most IDLE_FRAME_NS after the first change, so the caller redraws
+ * Returns 0 as soon as input is ready, or when no task has work left and nothing changed
+ */
+int idleRun(int input) {
+    struct timespec frame;
+    clock_gettime(CLOCK_MONOTONIC, &frame);
+    int changed = 0;
+
+    while (1) {
+        struct pollfd fds[IDLE_MAX_TASKS + 1] = {{.fd = input, .events = POLLIN}};
+        int nfds = 1, slot[IDLE_MAX_TASKS], wait[IDLE_MAX_TASKS];
+        int timeout = -1, any = 0;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (int i = 0; i < I.count; i++) {
+            int fd = -1;
+            wait[i] = -1;
+            slot[i] = -1;
+            if (!I.tasks[i].task->pending(&fd, &wait[i])) {
+                wait[i] = -2;
+                continue;
+            }
+            any = 1;
+            if (fd >= 0) {
+                slot[i] = nfds;
+                fds[nfds++] = (struct pollfd) {.fd = fd, .events = POLLIN};
+            }
+            if (wait[i] >= 0) {
+                long left = wait[i] - idleElapsed(&I.tasks[i].ran, &now) / 1000000;
+                if (left < 0) left = 0;
+                if (timeout < 0 || left < timeout) timeout = left;
+            }
+        }
+        if (!any) return changed;
+
+        if (changed) {
+            long left = (IDLE_FRAME_NS - idleElapsed(&frame, &now)) / 1000000;
+            if (left <= 0) return 1;
+            if (timeout < 0 || left < timeout) timeout = left;
+        }
+
+        if (poll(fds, nfds, timeout) == -1 && errno != EINTR)
+            die("In function: %s\r\nAt line: %d\r\npoll", __func__, __LINE__);
+        if (fds[0].revents & (POLLIN | POLLHUP)) return 0;
+
+        for (int k = 0; k < I.count; k++) {
+            int i = (I.next + k) % I.count;
+            if (wait[i] == -2) continue;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int ready = (slot[i] >= 0 && fds[slot[i]].revents) ||
+                        (wait[i] >= 0 && idleElapsed(&I.tasks[i].ran, &now) >= wait[i] * 1000000L);
+            if (!ready) continue;
+            if (idleInput(input)) return 0;
+
+            struct timespec cpu0, cpu1;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+            changed |= I.tasks[i].task->step(IDLE_SLICE_NS);
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+
+            long spent = idleElapsed(&cpu0, &cpu1);
+            I.tasks[i].cpu += spent;
+            I.tasks[i].steps++;
+            if (spent > I.tasks[i].longest) I.tasks[i].longest = spent;
+            clock_gettime(CLOCK_MONOTONIC, &I.tasks[i].ran);
+            I.next = (i + 1) % I.count;
+        }
+    }
+}
+
+/*
+ * Description:
+ * Writes the CPU time, number of steps, longest step and progress of every task that ran to buf
+ * Returns the length written
+ */
+int idleStats(char *buf, int size) {
+    int len = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < I.count && len < size; i++) {
+        if (!I.tasks[i].steps) continue;
+        const IdleTask *task = I.tasks[i].task;
+        len += snprintf(buf + len, size - len, "%s%s %.1fms in %ld slices, longest %.1fms", len ? " | " : "", task->name,
+                        I.tasks[i].cpu / 1e6, I.tasks[i].steps, I.tasks[i].longest / 1e6);
+
+        int progress = task->progress ? task->progress() : -1;
+        if (progress >= 0 && len < size)
+            len += snprintf(buf + len, size - len, " %d%%", progress / 10);
+    }
+    if (!len) len = snprintf(buf, size, "No background work has run");
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,253 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "input.h"
+
+#define INPUT_RING 256 /* keys decoded ahead of the editor, a power of 2 */
+
+typedef struct {
+    int key;
+    struct timespec read; /* when the first byte of the key was read */
+} InputEvent;
+
+/*
+ * The terminal is read and keys are decoded on a thread of their own, so bytes are taken off the tty as
+ * soon as they arrive, whatever the editor is busy with, and an escape sequence is never split by it
+ * Keys are handed over through a single producer, single consumer ring: the reader only writes head,
+ * the editor only writes tail. Every key is followed by a byte on the wake pipe, which the editor
+ * polls along with background work and reads before taking the key
+ */
+static struct {
+    InputEvent ring[INPUT_RING];
+    unsigned int head; /* next slot the reader fills */
+    unsigned int tail; /* next slot the editor takes */
+    int wake[2];
+    pthread_t reader;
+
+    /* keys taken by inputEscape() that were not ESC, handed out before the ring, only touched by the editor */
+    int held[INPUT_RING];
+    int nheld;
+
+    /* queueing delay, from the key being read to it being taken by the editor */
+    long keys;
+    long waited;
+    long longest;
+} I = {.head = 0, .tail = 0, .wake = {-1, -1}};
+
+static long inputElapsed(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+/*
+ * Description:
+ * Waits for the next byte from the terminal, more bytes of an escape sequence are read with the VTIME timeout
+ * Returns the decoded key, or 0 with *gone set when the terminal can not be read anymore
+ */
+static int inputDecode(struct timespec *read_at, int *gone) {
+    char c;
+    int nread;
+    struct pollfd fd = {.fd = STDIN_FILENO, .events = POLLIN};
+    do {
+        nread = 0;
+        if (poll(&fd, 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (!(fd.revents & POLLIN)) break;
+        nread = read(STDIN_FILENO, &c, 1);
+        if (nread == -1 && errno != EAGAIN && errno != EINTR) break;
+        if (nread == 0 && fd.revents & POLLHUP) break;
+    } while (nread != 1);
+    if (nread != 1) {
+        *gone = 1;
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, read_at);
+
+    if (c == '\x1b') {
+        char seq[3];
+
+        if (read(STDIN_FILENO, &seq[0], 1) != 1)
+            return '\x1b';
+        if (read(STDIN_FILENO, &seq[1], 1) != 1)
+            return '\x1b';
+
+        if (seq[0] != '[') {
+            if (seq[0] == 'O') {
+                switch (seq[1]) {
+                    case 'H':
+                        return HOME_KEY;
+                    case 'F':
+                        return END_KEY;
+                }
+            } else
+            return '\x1b';
+        }
+
+        if (seq[1] >= '0' && seq[1] < '9') {
+            if (read(STDIN_FILENO, &seq[2], 1) != 1)
+                return '\x1b';
+            if (seq[2] == '~') {
+                switch (seq[1]) {
+                    case '1':
+                        return HOME_KEY;
+                    case '3':
+                        return DELETE_KEY;
+                    case '4':
+                        return END_KEY;
+                    case '5':
+                        return PAGE_UP;
+                    case '6':
+                        return PAGE_DOWN;
+                    case '7':
+                        return HOME_KEY;
+                    case '8':
+                        return END_KEY;
+                }
+            }
+        }
+
+        switch (seq[1]) {
+            case 'A':
+                return ARROW_UP;
+            case 'B':
+                return ARROW_DOWN;
+            case 'C':
+                return ARROW_RIGHT;
+            case 'D':
+                return ARROW_LEFT;
+            case 'F':
+                return END_KEY;
+            case 'H':
+                return HOME_KEY;
+        }
+    }
+    return c;
+}
+
+/* Closing the wake pipe tells the editor the terminal is gone */
+static void *inputReader(void *arg) {
+    (void) arg;
+    /* signals, like SIGWINCH, are left to the editor thread */
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    while (1) {
+        InputEvent event;
+        int gone = 0;
+        event.key = inputDecode(&event.read, &gone);
+        if (gone) break;
+
+        /* a full ring stops the reading, the bytes wait in the tty until the editor catches up */
+        unsigned int head = I.head;
+        while (head - __atomic_load_n(&I.tail, __ATOMIC_ACQUIRE) == INPUT_RING) {
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+        I.ring[head % INPUT_RING] = event;
+        __atomic_store_n(&I.head, head + 1, __ATOMIC_RELEASE);
+
+        char b = 0;
+        while (write(I.wake[1], &b, 1) == -1 && errno == EINTR) {}
+    }
+    close(I.wake[1]);
+    return NULL;
+}
+
+/*
+ * Description:
+ * Starts reading the terminal, it is only read by the reader thread from here on
+ */
+void inputStart(void) {
+    if (pipe(I.wake) == -1) die("In function: %s\r\nAt line: %d\r\npipe", __func__, __LINE__);
+    fcntl(I.wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(I.wake[1], F_SETFD, FD_CLOEXEC);
+    if (pthread_create(&I.reader, NULL, inputReader, NULL))
+        die("In function: %s\r\nAt line: %d\r\npthread_create", __func__, __LINE__);
+    pthread_detach(I.reader);
+}
+
+/* Readable while keys are queued */
+int inputFd(void) {
+    return I.wake[0];
+}
+
+/* Takes the next key off the ring, waiting for one if it is empty */
+static int inputTake(void) {
+    char b;
+    ssize_t n;
+    while ((n = read(I.wake[0], &b, 1)) != 1) {
+        if (n == 0 || errno != EINTR) die("In function: %s\r\nAt line: %d\r\nread", __func__, __LINE__);
+    }
+
+    /* the byte is written after the key is in the ring, so there is one */
+    unsigned int tail = I.tail;
+    if (__atomic_load_n(&I.head, __ATOMIC_ACQUIRE) == tail)
+        die("In function: %s\r\nAt line: %d\r\nEmpty input queue", __func__, __LINE__);
+    InputEvent event = I.ring[tail % INPUT_RING];
+    __atomic_store_n(&I.tail, tail + 1, __ATOMIC_RELEASE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long waited = inputElapsed(&event.read, &now);
+    I.keys++;
+    I.waited += waited;
+    if (waited > I.longest) I.longest = waited;
+    return event.key;
+}
+
+/*
+ * Description:
+ * Takes the next key, held ones first, waiting for one if there is none
+ */
+int inputKey(void) {
+    if (I.nheld) {
+        int key = I.held[0];
+        memmove(I.held, I.held + 1, sizeof(int) * --I.nheld);
+        return key;
+    }
+    return inputTake();
+}
+
+/*
+ * Description:
+ * Takes the next queued key for code that only waits for ESC, like a running filter
+ * Other keys are held and handed out by inputKey() once the editor reads keys again
+ * Returns 1 when the key is ESC
+ */
+int inputEscape(void) {
+    int key = inputTake();
+    if (key == '\x1b') return 1;
+    if (I.nheld < INPUT_RING) I.held[I.nheld++] = key;
+    return 0;
+}
+
+/* Keys held by inputEscape() are waiting, they do not make inputFd() readable */
+int inputHeld(void) {
+    return I.nheld;
+}
+
+/*
+ * Description:
+ * Writes the number of keys taken and their average and longest time in the queue to buf
+ * Returns the length written
+ */
+int inputStats(char *buf, int size) {
+    int len = snprintf(buf, size, "keys %ld queued %.2fms longest %.1fms", I.keys,
+                       I.keys ? I.waited / 1e6 / I.keys : 0.0, I.longest / 1e6);
+    return len < size ? len : size - 1;
+}
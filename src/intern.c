@@ -0,0 +1,129 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "intern.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/*
+ * With S.internRows set, rows read from a file or a stream that are identical share one ROW_SHARED block,
+ * found through a table of every block made this way. The table holds no reference of its own: a block
+ * leaves it when it is freed, or taken over by the last row using it before that row is changed, so only
+ * blocks no row can change are ever found in it
+ * Rows shorter than ROW_INLINE_SIZE, blank ones included, are kept inside erow and never interned
+ */
+typedef struct {
+    char *chars; /* NULL for an empty slot */
+    size_t size;
+    size_t hash;
+} InternEntry;
+
+static struct {
+    InternEntry *table;
+    size_t capacity; /* a power of 2 */
+    size_t count;
+} N = {NULL, 0, 0};
+
+static size_t internHash(const char *s, size_t len) {
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) s[i];
+        hash *= FNV_PRIME;
+    }
+    return (size_t) hash;
+}
+
+/* Slot holding chars equal to s, or the empty slot it would go in */
+static size_t internFind(const char *s, size_t len, size_t hash) {
+    size_t i = hash & (N.capacity - 1);
+    while (N.table[i].chars) {
+        const InternEntry *e = &N.table[i];
+        if (e->hash == hash && e->size == len && !memcmp(e->chars, s, len)) break;
+        i = (i + 1) & (N.capacity - 1);
+    }
+    return i;
+}
+
+static void internGrow(void) {
+    InternEntry *old = N.table;
+    size_t capacity = N.capacity;
+    N.capacity = capacity ? capacity * 2 : 1024;
+    N.table = (InternEntry *) allocZero(ALLOC_ROWS, sizeof(InternEntry) * N.capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        if (!old[i].chars) continue;
+        size_t j = old[i].hash & (N.capacity - 1);
+        while (N.table[j].chars) j = (j + 1) & (N.capacity - 1);
+        N.table[j] = old[i];
+    }
+    allocFree(old);
+}
+
+/*
+ * Description:
+ * Initialises row with a copy of s like editorRowSet(), sharing the chars of an identical interned row when
+ * there is one, row is not expected to own any storage
+ */
+void internRow(erow *row, const char *s, size_t len) {
+    if (!S.internRows || len < ROW_INLINE_SIZE) {
+        editorRowSet(row, s, len);
+        return;
+    }
+
+    if ((N.count + 1) * 2 > N.capacity) internGrow();
+    size_t hash = internHash(s, len);
+    size_t i = internFind(s, len, hash);
+    if (!N.table[i].chars) {
+        char *chars = (char *) allocMem(ALLOC_ROWS, ROW_SHARED_BYTES(len));
+        memcpy(chars, s, len);
+        chars[len] = '\0';
+        *ROW_REFS(chars, len) = 0;
+        N.table[i] = (InternEntry) {chars, len, hash};
+        N.count++;
+    }
+    (*ROW_REFS(N.table[i].chars, len))++;
+
+    row->flags = ROW_SHARED;
+    row->osize = ROW_NEW;
+    row->render = NULL;
+    row->wraps = NULL;
+    row->rsize = 0;
+    row->size = len;
+    row->data.heap = N.table[i].chars;
+}
+
+/*
+ * Description:
+ * Drops chars from the table, called before a shared block is freed or taken over by its last row
+ * Blocks that were not interned are not found, and left alone
+ */
+void internForget(const char *chars, size_t size) {
+    if (!N.count || size < ROW_INLINE_SIZE) return;
+    size_t mask = N.capacity - 1;
+    size_t i = internHash(chars, size) & mask;
+    while (N.table[i].chars && N.table[i].chars != chars) i = (i + 1) & mask;
+    if (!N.table[i].chars) return;
+
+    /* entries after the hole that would not be found past it anymore are moved into it */
+    for (size_t j = (i + 1) & mask; N.table[j].chars; j = (j + 1) & mask) {
+        size_t home = N.table[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            N.table[i] = N.table[j];
+            i = j;
+        }
+    }
+    N.table[i].chars = NULL;
+    N.count--;
+}
+
+void internDelete(void) {
+    allocFree(N.table);
+    N.table = NULL;
+    N.capacity = N.count = 0;
+}
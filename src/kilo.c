@@ -5,51 +5,67 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 #include "lib.h"
+#include "alloc.h"
+#include "bracket.h"
+#include "buffer.h"
+#include "clip.h"
 #include "types.h"
 #include "editor.h"
 #include "history.h"
+#include "filter.h"
+#include "grep.h"
+#include "hex.h"
+#include "idle.h"
+#include "input.h"
+#include "intern.h"
+#include "load.h"
+#include "macro.h"
+#include "replace.h"
+#include "search.h"
+#include "session.h"
+#include "stream.h"
+#include "window.h"
+#include "wrap.h"
 
 /*** defines ***/
 #define CTRL_KEY(k) ((k) & 0x1f)
 
 #define KILO_VERSION "0.0.1"
 
-enum editorKey {
-    BACKSPACE = 127,
-    ARROW_UP = 1000,
-    ARROW_DOWN,
-    ARROW_LEFT,
-    ARROW_RIGHT,
-    PAGE_UP,
-    PAGE_DOWN,
-    HOME_KEY,
-    END_KEY,
-    DELETE_KEY,
-    EOL
-};
-
 /*** terminal ***/
 void disableRawMode(void) {
     for (int i=0; i < E.numrows; i++) {
-        free(E.row[i].chars);
-        free(E.row[i].render);
+        editorRowFree(&E.row[i]);
     }
-    free(E.row);
-    free(E.filename);
+    allocFree(E.row);
+    allocFree(E.filename);
 
-    if (E.message.length) free(E.message.data);
+    if (E.message.length) allocFree(E.message.data);
 
+    hexClose(1);
+    followStop();
+    clipDelete();
+    bracketDelete();
+    grepDelete();
+    bufferDelete();
     H.delete();
+    internDelete();
+    macroDelete();
+    windowDelete();
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         die("In function: %s\r\nAt line: %d\r\ntcsetattr", __func__, __LINE__);
@@ -72,72 +88,35 @@ void enableRawMode(void) {
         die("In function: %s\r\nAt line: %d\r\ntcsetattr", __func__, __LINE__);
 }
 
-int editorReadKey(void) {
-    char c;
-    int nread;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (nread == -1 && nread != EAGAIN)
-            die("In function: %s\r\nAt line: %d", __func__, __LINE__);
-    }
+/*
+ * Description:
+ * Runs background work, like loading stdin, search and follow, until a key is typed, redrawing as it goes
+ */
+void editorWaitForKey(void) {
+    while (!inputHeld() && idleRun(inputFd()))
+        editorRefreshScreen();
+}
 
-    if (c == '\x1b') {
-        char seq[3];
-
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
-
-        if (seq[0] != '[') {
-            if (seq[0] == 'O') {
-                switch (seq[1]) {
-                    case 'H':
-                        return HOME_KEY;
-                    case 'F':
-                        return END_KEY;
-                }
-            } else
-            return '\x1b';
-        }
+/*
+ * Description:
+ * Returns the next key typed, keys are decoded by the input thread and queued until they are taken
+ */
+int editorReadTerminalKey(void) {
+    editorWaitForKey();
+    return inputKey();
+}
 
-        if (seq[1] >= '0' && seq[1] < '9') {
-            if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                return '\x1b';
-            if (seq[2] == '~') {
-                switch (seq[1]) {
-                    case '1':
-                        return HOME_KEY;
-                    case '3':
-                        return DELETE_KEY;
-                    case '4':
-                        return END_KEY;
-                    case '5':
-                        return PAGE_UP;
-                    case '6':
-                        return PAGE_DOWN;
-                    case '7':
-                        return HOME_KEY;
-                    case '8':
-                        return END_KEY;
-                }
-            }
-        }
+/*
+ * Description:
+ * Returns the next key, taken from the macro being replayed if any, otherwise from the terminal
+ * Keys read from the terminal are recorded into the macro while recording
+ */
+int editorReadKey(void) {
+    int c;
+    if (macroNextKey(&c)) return c;
 
-        switch (seq[1]) {
-            case 'A':
-                return ARROW_UP;
-            case 'B':
-                return ARROW_DOWN;
-            case 'C':
-                return ARROW_RIGHT;
-            case 'D':
-                return ARROW_LEFT;
-            case 'F':
-                return END_KEY;
-            case 'H':
-                return HOME_KEY;
-        }
-    }
+    c = editorReadTerminalKey();
+    macroRecordKey(c);
     return c;
 }
 
@@ -181,10 +160,26 @@ int getWindowSize(int *rows, int *cols) {
 }
 
 /*** row operations ***/
+/*
+ * Description:
+ * Marks rows [start, end] as modified so that the next frame repaints them
+ * end == INT_MAX marks every row from start till the end of buffer (used when rows are inserted or removed)
+ */
+void editorMarkDirty(int start, int end) {
+    if (E.dirtystart > E.dirtyend) {
+        E.dirtystart = start;
+        E.dirtyend = end;
+        return;
+    }
+    if (start < E.dirtystart) E.dirtystart = start;
+    if (end > E.dirtyend) E.dirtyend = end;
+}
+
 int editorRowCxToRx(const erow *row, int cx) {
+    const char *chars = ROW_CHARS(row);
     int rx = 0;
     for (int i = 0; i < cx; i++) {
-        if (row->chars[i] == '\t')
+        if (chars[i] == '\t')
             rx += S.tabwidth - (rx % S.tabwidth);
         else
             rx++;
@@ -194,10 +189,11 @@ int editorRowCxToRx(const erow *row, int cx) {
 }
 
 int editorRowRxToCx(const erow *row, int rx) {
+    const char *chars = ROW_CHARS(row);
     int cx = 0;
     int i = 0;
     while (cx < (int)row->size && i < rx) {
-        if (row->chars[cx] == '\t') {
+        if (chars[cx] == '\t') {
             if (i + S.tabwidth - (i % S.tabwidth) - 1 >= rx)
                 break;
             i += S.tabwidth - (i % S.tabwidth) - 1;
@@ -209,45 +205,283 @@ int editorRowRxToCx(const erow *row, int rx) {
     return cx;
 }
 
+/*
+ * Description:
+ * Gives row its own copy of chars shared with other rows, so they can be changed
+ * Returns the chars of row
+ */
+char *editorRowWritable(erow *row) {
+    if (!(row->flags & ROW_SHARED)) return ROW_CHARS(row);
+
+    char *shared = row->data.heap;
+    size_t *refs = ROW_REFS(shared, row->size);
+    if (*refs > 1) {
+        (*refs)--;
+        row->data.heap = (char *) allocMem(ALLOC_ROWS, row->size + 1);
+        memcpy(row->data.heap, shared, row->size + 1);
+    } else {
+        internForget(shared, row->size);
+    }
+    row->flags &= ~ROW_SHARED;
+    return row->data.heap;
+}
+
+/*
+ * Description:
+ * Resizes storage of row to hold `size` characters plus the null character
+ * Rows shorter than ROW_INLINE_SIZE are kept inside erow itself, longer ones on heap
+ * Content is kept up to the smaller of the old and new capacities
+ * Returns the (possibly moved) chars of row
+ */
+char *editorRowReserve(erow *row, size_t size) {
+    editorRowWritable(row);
+    if (size < ROW_INLINE_SIZE) {
+        if (!(row->flags & ROW_INLINE)) {
+            char *heap = row->data.heap;
+            memcpy(row->data.buf, heap, size + 1);
+            allocFree(heap);
+            row->flags |= ROW_INLINE;
+        }
+        return row->data.buf;
+    }
+
+    if (row->flags & ROW_INLINE) {
+        char *heap = (char *) allocMem(ALLOC_ROWS, size + 1);
+        memcpy(heap, row->data.buf, ROW_INLINE_SIZE);
+        row->data.heap = heap;
+        row->flags &= ~ROW_INLINE;
+    } else {
+        row->data.heap = (char *) allocResize(ALLOC_ROWS, row->data.heap, size + 1);
+    }
+    return row->data.heap;
+}
+
+/*
+ * Description:
+ * Initialises row with a copy of s, row is not expected to own any storage
+ */
+void editorRowSet(erow *row, const char *s, size_t len) {
+    row->flags = ROW_INLINE;
+    row->osize = ROW_NEW;
+    row->render = NULL;
+    row->wraps = NULL;
+    row->rsize = 0;
+    row->size = len;
+
+    char *chars = editorRowReserve(row, len);
+    memcpy(chars, s, len);
+    chars[len] = '\0';
+}
+
+/*
+ * Description:
+ * Replaces content of row with chars of length len, chars should be allocated with allocMem() and is owned by row afterwards
+ */
+void editorRowAdopt(erow *row, char *chars, size_t len) {
+    editorRowFree(row);
+    row->flags = 0;
+    row->data.heap = chars;
+    row->size = len;
+    if (len < ROW_INLINE_SIZE) editorRowReserve(row, len);
+    editorUpdateRow(row);
+}
+
+/*
+ * Description:
+ * Initialises row with the chars of src without copying them, both rows share the chars afterwards
+ * Rows short enough to be kept inline are copied, row is not expected to own any storage
+ */
+void editorRowShare(erow *row, erow *src) {
+    if (src->flags & ROW_INLINE) {
+        editorRowSet(row, ROW_CHARS(src), src->size);
+        return;
+    }
+    if (!(src->flags & ROW_SHARED)) {
+        src->data.heap = (char *) allocResize(ALLOC_ROWS, src->data.heap, ROW_SHARED_BYTES(src->size));
+        *ROW_REFS(src->data.heap, src->size) = 1;
+        src->flags |= ROW_SHARED;
+    }
+    (*ROW_REFS(src->data.heap, src->size))++;
+
+    row->flags = ROW_SHARED | (src->flags & ROW_TABS);
+    row->osize = ROW_NEW;
+    row->render = NULL;
+    row->wraps = NULL;
+    row->rsize = src->rsize;
+    row->size = src->size;
+    row->data.heap = src->data.heap;
+}
+
+void editorRowFree(erow *row) {
+    if (row->flags & ROW_SHARED) {
+        size_t *refs = ROW_REFS(row->data.heap, row->size);
+        if (!--*refs) {
+            internForget(row->data.heap, row->size);
+            allocFree(row->data.heap);
+        }
+    } else if (!(row->flags & ROW_INLINE)) {
+        allocFree(row->data.heap);
+    }
+    row->flags = ROW_INLINE;
+    row->data.buf[0] = '\0';
+    row->size = 0;
+    allocFree(row->render);
+    row->render = NULL;
+    allocFree(row->wraps);
+    row->wraps = NULL;
+}
+
+/*
+ * Description:
+ * Returns the rendered size of size chars, tabs is set when there is a tab among them
+ */
+size_t editorRenderSize(const char *chars, size_t size, int *tabs) {
+    size_t rsize = 0;
+    *tabs = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (chars[i] == '\t') {
+            rsize += S.tabwidth - (rsize % S.tabwidth);
+            *tabs = 1;
+        } else
+            rsize++;
+    }
+    return rsize;
+}
+
+/*
+ * Description:
+ * Recomputes the rendered size of row after its chars changed
+ * The render buffer itself is only built when the row is drawn, see editorRowRender()
+ */
 void editorUpdateRow(erow *row) {
-    int tabcount = 0;
-    for (size_t i = 0; i < row->size; i++)
-        if (row->chars[i] == '\t')
-            tabcount++;
+    int hasTabs;
+    row->rsize = editorRenderSize(ROW_CHARS(row), row->size, &hasTabs);
+    row->flags |= ROW_DIRTY;
+    row->flags &= ~ROW_BRACKETS;
+    if (hasTabs) row->flags |= ROW_TABS;
+    else row->flags &= ~ROW_TABS;
+    allocFree(row->render);
+    row->render = NULL;
+    allocFree(row->wraps);
+    row->wraps = NULL;
+
+    int at = row - E.row;
+    editorMarkDirty(at, at);
+    bracketChanged(at);
+}
 
-    row->render = realloc(row->render, row->size + tabcount * (S.tabwidth - 1) + 1);
-    if (!row->render) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+/*
+ * Description:
+ * Returns the tab expanded chars of row
+ * Rows without tabs render as their chars, for the others render is built on first use
+ */
+const char *editorRowRender(erow *row) {
+    if (!(row->flags & ROW_TABS)) return ROW_CHARS(row);
+    if (row->render) return row->render;
 
+    row->render = (char *) allocMem(ALLOC_ROWS, row->rsize + 1);
+
+    const char *chars = ROW_CHARS(row);
     size_t idx = 0;
     for (size_t j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
+        if (chars[j] == '\t') {
             row->render[idx++] = ' ';
             while (idx % S.tabwidth != 0) {
                 row->render[idx++] = ' ';
             }
         } else {
-            row->render[idx++] = row->chars[j];
+            row->render[idx++] = chars[j];
         }
     }
-
     row->render[idx] = '\0';
-    row->rsize = idx;
+
+    return row->render;
 }
 
 void editorRowAppend(const char *s, size_t len) {
-    E.row = (erow *) realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    if (!E.row) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+    E.row = (erow *) allocResize(ALLOC_ROWS, E.row, sizeof(erow) * (E.numrows + 1));
 
     int at = E.numrows;
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+    internRow(&E.row[at], s, len);
     E.numrows++;
 
-    E.row[at].render = NULL;
-    E.row[at].rsize = 0;
     editorUpdateRow(&E.row[at]);
+    editorMarkDirty(at, INT_MAX);
+    bracketInvalidate(at);
+    if (at < E.firstmoved) E.firstmoved = at;
+}
+
+/*
+ * Description:
+ * Replaces `count` rows starting at `at` with the rows of `with`, which are moved in (with itself is freed)
+ * Returns the replaced rows, that are moved out of the buffer the same way
+ * CAUTION: The returned list should be freed by the caller with editorRowsFree(), or put back with this function
+ */
+erowList *editorRowsReplace(int at, int count, erowList *with) {
+    erowList *taken = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    taken->count = count;
+    memcpy(taken->rows, E.row + at, sizeof(erow) * count);
+
+    int nrows = with->count;
+    int numrows = E.numrows - count + nrows;
+    if (nrows > count) {
+        E.row = (erow *) allocResize(ALLOC_ROWS, E.row, sizeof(erow) * numrows);
+    }
+    memmove(E.row + at + nrows, E.row + at + count, sizeof(erow) * (E.numrows - at - count));
+    memcpy(E.row + at, with->rows, sizeof(erow) * nrows);
+    if (nrows < count) {
+        E.row = (erow *) allocResize(ALLOC_ROWS, E.row, sizeof(erow) * numrows);
+    }
+    E.numrows = numrows;
+    allocFree(with);
+
+    for (int i = at; i < at + nrows; i++)
+        editorUpdateRow(&E.row[i]);
+    editorMarkDirty(at, INT_MAX);
+    bracketInvalidate(at);
+    if (at < E.firstmoved) E.firstmoved = at;
+
+    return taken;
+}
+
+/*
+ * Description:
+ * Held by threads that read rows, and by the UI thread while it changes rows in the background
+ * Edits made from key presses do not take it, no worker runs while they are possible
+ */
+static pthread_mutex_t rowsLock = PTHREAD_MUTEX_INITIALIZER;
+
+void editorRowsLock(void) {
+    pthread_mutex_lock(&rowsLock);
+}
+
+void editorRowsUnlock(void) {
+    pthread_mutex_unlock(&rowsLock);
+}
+
+// CAUTION: The list returned should be freed by the caller with editorRowsFree()
+erowList *editorRowsCopy(const erow *rows, int count) {
+    erowList *list = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    list->count = count;
+    for (int i = 0; i < count; i++)
+        editorRowSet(&list->rows[i], ROW_CHARS(&rows[i]), rows[i].size);
+    return list;
+}
+
+// CAUTION: The list returned should be freed by the caller with editorRowsFree()
+erowList *editorRowsShare(erow *rows, int count) {
+    erowList *list = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    list->count = count;
+    for (int i = 0; i < count; i++)
+        editorRowShare(&list->rows[i], &rows[i]);
+    return list;
+}
+
+void editorRowsFree(erowList *list) {
+    if (!list) return;
+    for (int i = 0; i < list->count; i++)
+        editorRowFree(&list->rows[i]);
+    allocFree(list);
 }
 
 /*
@@ -259,10 +493,9 @@ void editorRowInsertCharAfter(int curline, int cat, const char *s, const int len
     erow *row = &E.row[curline];
     if (cat < 0 || cat > (int) row->size) cat = row->size;
 
-    row->chars = (char *) realloc(row->chars, row->size + len + 1);
-    if (!row->chars) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
-    memmove(row->chars + cat + len, row->chars + cat, row->size - cat + 1);
-    memcpy(row->chars + cat, s, len);
+    char *chars = editorRowReserve(row, row->size + len);
+    memmove(chars + cat + len, chars + cat, row->size - cat + 1);
+    memcpy(chars + cat, s, len);
 
     row->size += len;
 
@@ -291,8 +524,7 @@ void editorRowInsertCharBefore(int curline, int cat, const char *s, const int le
 void editorRowInsertAfter(int curline, int cat) {
     if (curline < 0 || curline >= E.numrows) curline = E.numrows - 1;
 
-    E.row = (erow *) realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    if (!E.row) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+    E.row = (erow *) allocResize(ALLOC_ROWS, E.row, sizeof(erow) * (E.numrows + 1));
 
     erow *currow = E.row + curline;
 
@@ -301,20 +533,17 @@ void editorRowInsertAfter(int curline, int cat) {
     if (curline < E.numrows - 1)
         memmove(currow + 2, currow + 1, sizeof(erow) * (E.numrows - curline - 1));
 
-    int size = currow->size - cat;
-    erow nextrow = {.size = size};
+    erow nextrow = {0};
+    editorRowSet(&nextrow, ROW_CHARS(currow) + cat, currow->size - cat);
 
-    nextrow.chars = (char *) malloc(size + 1);
-    if (!nextrow.chars) die("In function: %s\r\nAt line: %d\r\nmalloc", __func__, __LINE__);
-
-    memcpy(nextrow.chars, &currow->chars[cat], currow->size + 1 - cat);
-    currow->chars[cat] = '\0';
-
-    currow->chars = (char *) realloc(currow->chars, cat + 1);
-    if (!currow->chars) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+    editorRowWritable(currow)[cat] = '\0';
+    editorRowReserve(currow, cat);
 
     currow->size = cat;
     E.numrows++;
+    editorMarkDirty(curline, INT_MAX);
+    bracketInvalidate(curline);
+    if (curline + 1 < E.firstmoved) E.firstmoved = curline + 1;
     E.row[curline + 1] = nextrow;
     editorUpdateRow(&E.row[curline]);
     editorUpdateRow(&E.row[curline + 1]);
@@ -367,28 +596,18 @@ void editorRemoveChars(int curline, int cat, int clen) {
         int prevRowRsize = prevrow->rsize;
         int curRowSize = currow->size;
 
-        prevrow->chars = (char *) realloc(prevrow->chars, prevRowSize + curRowSize + 1);
-        if (!prevrow->chars) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
-
-        memmove(&prevrow->chars[prevRowSize], currow->chars, curRowSize + 1);
+        char *chars = editorRowReserve(prevrow, prevRowSize + curRowSize);
+        memcpy(&chars[prevRowSize], ROW_CHARS(currow), curRowSize + 1);
         prevrow->size += curRowSize;
         editorUpdateRow(prevrow);
 
-        if (curline + 1 < E.numrows) {
-            free(currow->chars);
-            free(currow->render);
-
-            memmove(E.row + curline, E.row + curline + 1, sizeof(erow) * (E.numrows - curline - 2));
-
-            erow *lastrow = &E.row[E.numrows - 1];
-
-            E.row[E.numrows - 2] = (erow) {lastrow->size, strdup(lastrow->chars), lastrow->rsize, strdup(lastrow->render)};
-        }
+        editorRowFree(currow);
+        memmove(E.row + curline, E.row + curline + 1, sizeof(erow) * (E.numrows - curline - 1));
         E.numrows--;
-        free(E.row[E.numrows].chars);
-        free(E.row[E.numrows].render);
-        E.row = (erow *) realloc(E.row, E.numrows * sizeof(erow));
-        if (!E.row) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+        editorMarkDirty(curline - 1, INT_MAX);
+        bracketInvalidate(curline - 1);
+        if (curline < E.firstmoved) E.firstmoved = curline;
+        E.row = (erow *) allocResize(ALLOC_ROWS, E.row, E.numrows * sizeof(erow));
 
         E.cy--;
         E.cx = prevRowSize;
@@ -401,55 +620,46 @@ void editorRemoveChars(int curline, int cat, int clen) {
 
         erow *nextrow = &E.row[curline + 1];
 
-        currow->chars = (char*) realloc(currow->chars, cat + nextrow->size + 1);
-        memcpy(currow->chars + cat, nextrow->chars, nextrow->size + 1);
+        char *chars = editorRowReserve(currow, cat + nextrow->size);
+        memcpy(chars + cat, ROW_CHARS(nextrow), nextrow->size + 1);
         currow->size = cat + nextrow->size;
 
         editorUpdateRow(currow);
 
-        erow *lastrow = &E.row[E.numrows - 1];
-        if (curline + 1 < E.numrows - 1) {
-            free(nextrow->chars);
-            free(nextrow->render);
-
-            if (curline + 2 < E.numrows - 1)
-                memmove(nextrow, &E.row[curline + 2], sizeof(erow) * (E.numrows - (curline + 3)));
-
-            E.row[E.numrows - 2] = (erow) {lastrow->size, strdup(lastrow->chars), lastrow->rsize, strdup(lastrow->render)};
-        }
-
-        free(lastrow->chars);
-        free(lastrow->render);
+        editorRowFree(nextrow);
+        memmove(nextrow, nextrow + 1, sizeof(erow) * (E.numrows - curline - 2));
         E.numrows--;
-        E.row = (erow*) realloc(E.row, sizeof(erow) * E.numrows);
+        editorMarkDirty(curline, INT_MAX);
+        bracketInvalidate(curline);
+        if (curline + 1 < E.firstmoved) E.firstmoved = curline + 1;
+        E.row = (erow*) allocResize(ALLOC_ROWS, E.row, sizeof(erow) * E.numrows);
 
         if (clen < 0) editorRemoveChars(curline, cat, clen);
     } else {
+        char *chars = editorRowWritable(currow);
         char *src = NULL, *dest = NULL;
         int movesize = 0;
         if (clen < 0) {
             // DELETE
-            src = currow->chars + cat - clen;
-            dest = currow->chars + cat;
+            src = chars + cat - clen;
+            dest = chars + cat;
             movesize = currow->size - (cat - clen) + 1;
         } else {
             // BACKSPACE
-            src = currow->chars + cat;
-            dest = currow->chars + cat - clen;
+            src = chars + cat;
+            dest = chars + cat - clen;
             movesize = currow->size - cat + 1;
         }
 
         memmove(dest, src, movesize);
 
         currow->size -= abs(clen);
-
-        currow->chars = (char *) realloc(currow->chars, currow->size + 1);
-        if (!E.row) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+        editorRowReserve(currow, currow->size);
 
         editorUpdateRow(currow);
 
         if (clen > 0) {
-            E.cx -= clen;
+            E.cx = cat - clen;
             E.rx = editorRowCxToRx(currow, E.cx);
             E.max_rx = E.rx;
         }
@@ -457,14 +667,8 @@ void editorRemoveChars(int curline, int cat, int clen) {
 }
 
 /*** append buffer ***/
-struct abuf {
-    char *b;
-    size_t len;
-};
-
 void abAppend(struct abuf *ab, const char *s, size_t len) {
-    char *new = (char *) realloc(ab->b, ab->len + len + 1);
-    if (!new) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+    char *new = (char *) allocResize(ALLOC_IO, ab->b, ab->len + len + 1);
 
     memcpy(&new[ab->len], s, len);
     ab->b = new;
@@ -473,7 +677,7 @@ void abAppend(struct abuf *ab, const char *s, size_t len) {
 }
 
 void abFree(struct abuf *ab) { 
-    free(ab->b); 
+    allocFree(ab->b); 
 }
 
 /*** output ***/
@@ -494,16 +698,53 @@ void welcome(struct abuf *ab) {
     abAppend(ab, welcome, welcomelen);
 }
 
+/*
+ * Description:
+ * Keeps the cursor in view when rows wrap, the view starts at line rowsub of row rowoff
+ * Lines are only counted between the top of the view and the cursor, which are at most a screen apart
+ * otherwise the view is placed relative to the cursor
+ */
+static void editorScrollWrapped(int scrolloff) {
+    E.coloff = 0;
+    if (E.rowsub >= wrapLines(&E.row[E.rowoff])) E.rowsub = 0;
+
+    int line = wrapLineOf(&E.row[E.cy], E.rx);
+    if (E.cy < E.rowoff || (E.cy == E.rowoff && line < E.rowsub)) {
+        E.rowoff = E.cy;
+        E.rowsub = line;
+        wrapUp(&E.rowoff, &E.rowsub, scrolloff);
+        return;
+    }
+
+    int bottom = E.screenrows - 1 - wrapLinesBelow(E.cy, line, scrolloff);
+    int d = wrapDistance(E.rowoff, E.rowsub, E.cy, line, E.screenrows);
+    if (d > bottom || d < scrolloff) {
+        E.rowoff = E.cy;
+        E.rowsub = line;
+        wrapUp(&E.rowoff, &E.rowsub, d > bottom ? bottom : scrolloff);
+    }
+}
+
 void editorScroll(void) {
+    /* margins can not exceed half of a (split) window */
+    int scrolloff = S.scrolloff;
+    if (scrolloff > (E.screenrows - 1) / 2) scrolloff = (E.screenrows - 1) / 2;
+
+    if (S.softwrap) {
+        editorScrollWrapped(scrolloff);
+        return;
+    }
+    E.rowsub = 0;
+
     if (E.numrows < E.screenrows);
-    else if (E.cy < E.rowoff + S.scrolloff) {
-        if (E.cy > S.scrolloff)
-            E.rowoff = E.cy - S.scrolloff;
+    else if (E.cy < E.rowoff + scrolloff) {
+        if (E.cy > scrolloff)
+            E.rowoff = E.cy - scrolloff;
         else
             E.rowoff = 0;
-    } else if (E.cy > E.rowoff + E.screenrows - S.scrolloff - 1) {
-        if (E.cy + S.scrolloff < E.numrows)
-            E.rowoff = E.cy - E.screenrows + S.scrolloff + 1;
+    } else if (E.cy > E.rowoff + E.screenrows - scrolloff - 1) {
+        if (E.cy + scrolloff < E.numrows)
+            E.rowoff = E.cy - E.screenrows + scrolloff + 1;
         else
             E.rowoff = E.numrows - E.screenrows;
     }
@@ -515,59 +756,242 @@ void editorScroll(void) {
     }
 }
 
+static int drawingActive; /* the window being drawn is the active one, only it shows the selection */
+
+/*
+ * Description:
+ * Appends `len` render columns of row `at` from `start`
+ * The selection of the active window, or else the match the cursor is on, is drawn inverted,
+ * otherwise brackets of the pair around the cursor of the active window are drawn bold and underlined
+ */
+static void editorDrawText(struct abuf *ab, int at, int start, int len) {
+    const char *render = editorRowRender(&E.row[at]) + start;
+    int mrow, mcol, mlen, sfrom, sto;
+    int cols[2], lens[2] = {1, 1}, n = 0; /* chars drawn highlighted, in order */
+    const char *attr = "\x1b[7m";
+    if (drawingActive && clipSelection(at, &sfrom, &sto)) {
+        cols[0] = sfrom;
+        lens[0] = sto - sfrom;
+        n = 1;
+    } else if (searchCurrent(&mrow, &mcol, &mlen) && mrow == at) {
+        cols[0] = mcol;
+        lens[0] = mlen;
+        n = 1;
+    } else if (drawingActive) {
+        n = bracketHighlight(at, cols);
+        attr = "\x1b[1;4m";
+    }
+
+    int pos = 0;
+    for (int i = 0; i < n; i++) {
+        int from = editorRowCxToRx(&E.row[at], cols[i]) - start;
+        int to = editorRowCxToRx(&E.row[at], cols[i] + lens[i]) - start;
+        if (from < pos) from = pos;
+        if (from > len) from = len;
+        if (to > len) to = len;
+        if (to < from) to = from;
+
+        abAppend(ab, render + pos, from - pos);
+        abAppend(ab, attr, strlen(attr));
+        abAppend(ab, render + from, to - from);
+        abAppend(ab, "\x1b[m", 3);
+        pos = to;
+    }
+    abAppend(ab, render + pos, len - pos);
+}
+
+/*
+ * Description:
+ * Draws screen line y of the window, showing render columns [start, end) of row currow
+ * Rows past the end of buffer are drawn as '~'
+ */
+void editorDrawRow(struct abuf *ab, int y, int currow, int start, int end, int isWelcome) {
+    char pos[16];
+    int poslen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", E.screentop + y + 1, E.screenleft + 1);
+    abAppend(ab, pos, poslen);
+
+    int len = 1;
+    if (currow >= E.numrows) {
+        if (isWelcome && y == 2 * E.screenrows / 3) {
+            len = ab->len;
+            welcome(ab);
+            len = ab->len - len;
+        } else
+        abAppend(ab, "~", 1);
+    } else {
+        len = end - start;
+        if (len < 0)
+            len = 0;
+        if (E.screencols < len)
+            len = E.screencols;
+        if (len)
+            editorDrawText(ab, currow, start, len);
+    }
+
+    if (E.screenleft + E.screencols >= E.termcols) {
+        abAppend(ab, "\x1b[K", 3); /* Clear line to the right of cursor */
+    } else {
+        /* a window on the left must not clear the ones to its right */
+        while (len++ < E.screencols)
+            abAppend(ab, " ", 1);
+    }
+}
+
+/*
+ * Description:
+ * Draws the lines of the window in E when rows wrap
+ * The whole window is drawn when the view moved, otherwise from the first changed row down,
+ * as an edited row may now take a different number of lines
+ */
+static void editorDrawRowsWrapped(struct abuf *ab, int isWelcome) {
+    int full = E.prevrowoff != E.rowoff || E.prevrowsub != E.rowsub || isWelcome != E.prevwelcome;
+
+    /* render buffers of rows that scrolled out of view are released, a row takes at least one line */
+    int row = E.rowoff, line = E.rowsub, rest = full;
+    for (int y = 0; y < E.screenrows; y++) {
+        if (row >= E.dirtystart && row <= E.dirtyend) rest = 1;
+        if (row >= E.numrows) {
+            if (rest) editorDrawRow(ab, y, row, 0, 0, isWelcome);
+            continue;
+        }
+
+        erow *r = &E.row[row];
+        int lines = wrapLines(r);
+        if (rest) {
+            int start = wrapStart(r, line);
+            int end = line + 1 < lines ? wrapStart(r, line + 1) : (int) r->rsize;
+            editorDrawRow(ab, y, row, start, end, isWelcome);
+        }
+        if (++line == lines) {
+            row++;
+            line = 0;
+        }
+    }
+
+    if (E.prevrowoff >= 0 && full) {
+        for (int r = E.prevrowoff; r < E.prevrowoff + E.screenrows && r < E.numrows; r++) {
+            if (r < E.rowoff || r >= row) {
+                allocFree(E.row[r].render);
+                E.row[r].render = NULL;
+            }
+        }
+    }
+
+    E.prevrowoff = E.rowoff;
+    E.prevrowsub = E.rowsub;
+    E.prevcoloff = E.coloff;
+    E.prevwelcome = isWelcome;
+}
+
+/*
+ * Description:
+ * Draws only the rows of the window in E that changed since the last frame
+ * When only rowoff moved by less than a screen, the window is shifted with a scroll region (DECSTBM + SU/SD)
+ * and just the newly exposed rows are drawn. Scroll regions span whole lines, so it is only done for
+ * windows as wide as the terminal
+ */
 void editorDrawRows(struct abuf *ab) {
     editorScroll();
 
-    for (int y = 0; y < E.screenrows; y++) {
-        if (y >= E.numrows) {
-            if ((E.numrows == 1 && E.row[0].size == 0) && y == 2 * E.screenrows / 3) {
-                welcome(ab);
-            } else
-            abAppend(ab, "~", 1);
+    int isWelcome = E.numrows == 1 && E.row[0].size == 0;
+    if (S.softwrap) {
+        editorDrawRowsWrapped(ab, isWelcome);
+        return;
+    }
+
+    int full = E.prevrowoff < 0 || E.coloff != E.prevcoloff || isWelcome != E.prevwelcome;
+    int delta = E.rowoff - E.prevrowoff;
+    if (abs(delta) >= E.screenrows || (delta && E.screencols < E.termcols)) full = 1;
+
+    int exposedFrom = 0, exposedTo = 0; /* screen rows [from, to) uncovered by scrolling */
+    /* render buffers of rows that scrolled out of view are released */
+    if (E.prevrowoff >= 0 && delta) {
+        for (int y = 0; y < E.screenrows; y++) {
+            int currow = E.prevrowoff + y;
+            if (currow >= E.numrows) break;
+            if (currow < E.rowoff || currow >= E.rowoff + E.screenrows) {
+                allocFree(E.row[currow].render);
+                E.row[currow].render = NULL;
+            }
+        }
+    }
+
+    if (!full && delta) {
+        char seq[32];
+        int seqlen = snprintf(seq, sizeof(seq), "\x1b[%d;%dr\x1b[%d%c\x1b[r", E.screentop + 1,
+                              E.screentop + E.screenrows, abs(delta), delta > 0 ? 'S' : 'T');
+        abAppend(ab, seq, seqlen);
+
+        if (delta > 0) {
+            exposedFrom = E.screenrows - delta;
+            exposedTo = E.screenrows;
         } else {
-            int currow = y + E.rowoff;
-            int len = E.row[currow].rsize - E.coloff;
-            if (len < 0)
-                len = 0;
-            if (E.screencols < len)
-                len = E.screencols;
-            abAppend(ab, &E.row[currow].render[E.coloff], len);
+            exposedFrom = 0;
+            exposedTo = -delta;
         }
+    }
 
-        abAppend(ab, "\x1b[K", 3); /* Clear line to the right of cursor */
-        abAppend(ab, "\r\n", 2);
+    for (int y = 0; y < E.screenrows; y++) {
+        int currow = y + E.rowoff;
+        if (full || (y >= exposedFrom && y < exposedTo) ||
+            (currow >= E.dirtystart && currow <= E.dirtyend))
+            editorDrawRow(ab, y, currow, E.coloff, currow < E.numrows ? (int) E.row[currow].rsize : 0, isWelcome);
     }
+
+    E.prevrowoff = E.rowoff;
+    E.prevcoloff = E.coloff;
+    E.prevwelcome = isWelcome;
 }
 
 /*** output: status & message bar ***/
 void editorDrawStatusBar(struct abuf *ab) {
+    char pos[16];
+    int poslen = snprintf(pos, sizeof(pos), "\x1b[%d;1H", E.termrows - 1);
+    abAppend(ab, pos, poslen);
+
     abAppend(ab, "\x1b[7m", 4); /* Inverts the fg and bg colors */
     int idx = 0;
 
     char status[13];
     ssize_t statusLength;
     statusLength = snprintf(status, sizeof(status), "%d,%d", E.cy + 1, E.rx + 1);
+    if (hexActive()) statusLength = snprintf(status, sizeof(status), "0x%zx", hexOffset());
 
-    char name[50];
+    char name[80];
     ssize_t nameLength;
-    nameLength =
-        snprintf(name, sizeof(name), "%.*s - %d lines", S.maxFileNameSize,
-                 E.filename ? E.filename : "[No File]", E.numrows);
-
-    if (nameLength + statusLength + 1 > E.screencols) {
-        if (statusLength + 1 > E.screencols) {
-            statusLength = E.screencols;
+    nameLength = 0;
+    if (hexActive())
+        nameLength = hexStatus(name, sizeof(name));
+    else if (bufferCount() > 1)
+        nameLength = snprintf(name, sizeof(name), "%d/%d ", bufferActive() + 1, bufferCount());
+    if (nameLength >= (ssize_t) sizeof(name)) nameLength = sizeof(name) - 1;
+    if (!hexActive() && nameLength < (ssize_t) sizeof(name) - 1)
+        nameLength +=
+            snprintf(name + nameLength, sizeof(name) - nameLength, "%.*s - %d lines", S.maxFileNameSize,
+                     E.filename ? E.filename : "[No File]", E.numrows);
+    if (nameLength >= (ssize_t) sizeof(name)) nameLength = sizeof(name) - 1;
+    if (streamPending() && nameLength < (ssize_t) sizeof(name) - 1)
+        nameLength += snprintf(name + nameLength, sizeof(name) - nameLength, " (loading %zu MB)",
+                               streamLoaded() >> 20);
+    if (nameLength >= (ssize_t) sizeof(name)) nameLength = sizeof(name) - 1;
+    if (nameLength < (ssize_t) sizeof(name) - 1)
+        nameLength += searchStatus(name + nameLength, sizeof(name) - nameLength);
+    if (nameLength >= (ssize_t) sizeof(name)) nameLength = sizeof(name) - 1;
+
+    if (nameLength + statusLength + 1 > E.termcols) {
+        if (statusLength + 1 > E.termcols) {
+            statusLength = E.termcols;
             nameLength = 0;
         } else {
-            nameLength = E.screencols - statusLength - 1;
+            nameLength = E.termcols - statusLength - 1;
         }
     }
     idx = nameLength;
 
     abAppend(ab, name, nameLength);
 
-    while (idx < E.screencols) {
-        if (E.screencols - idx == statusLength) {
+    while (idx < E.termcols) {
+        if (E.termcols - idx == statusLength) {
             abAppend(ab, status, statusLength);
             break;
         }
@@ -579,13 +1003,13 @@ void editorDrawStatusBar(struct abuf *ab) {
 }
 
 void editorClearMessage (void) {
-    if (E.message.length) free(E.message.data);
+    if (E.message.length) allocFree(E.message.data);
     E.message.length = 0;
 }
 
 void editorSetMessage(char *fmt, ...) {
     if (E.message.length) editorClearMessage();
-    E.message.data = (char *) malloc(S.maxMsgSize);
+    E.message.data = (char *) allocMem(ALLOC_IO, S.maxMsgSize);
 
     va_list ap;
     va_start(ap, fmt);
@@ -599,7 +1023,7 @@ void editorSetMessage(char *fmt, ...) {
     }
 
     if (E.message.isFocus) {
-        E.message.cy = E.screenrows + 1;
+        E.message.cy = E.termrows - 1;
         E.message.cx = E.message.length;
     }
 
@@ -607,8 +1031,7 @@ void editorSetMessage(char *fmt, ...) {
 }
 
 void editorAppendMessage (const char *s, const int length) {
-    char *new = realloc(E.message.data, E.message.length + length + 1);
-    if (!new) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+    char *new = allocResize(ALLOC_IO, E.message.data, E.message.length + length + 1);
 
     memcpy(new + E.message.length, s, length);
     E.message.data = new;
@@ -624,7 +1047,7 @@ void editorAppendMessage (const char *s, const int length) {
 
 void editorDrawMessageBar(struct abuf *ab) {
     abAppend(ab, "\x1b[K", 3);
-    if (E.message.length > E.screencols) E.message.length = E.screencols;
+    if (E.message.length > E.termcols) E.message.length = E.termcols;
     if (E.message.isFocus || (E.message.length && time(NULL) - E.message.time < 5))
         abAppend(ab, E.message.data, E.message.length);
     if (!E.message.isFocus && time(NULL) - E.message.time > 5) 
@@ -632,20 +1055,50 @@ void editorDrawMessageBar(struct abuf *ab) {
 }
 
 void editorRefreshScreen(void) {
+    /* a replaying macro renders a single frame once it is done */
+    if (macroIsReplaying()) return;
+
     struct abuf ab = {NULL, 0};
 
     abAppend(&ab, "\x1b[?25l", 6); /* Hide cursor */
-    abAppend(&ab, "\x1b[H", 3);    /* Move cursor to top-left */
 
-    editorDrawRows(&ab);
+    if (hexActive()) {
+        hexDrawRows(&ab);
+    } else {
+        int active = windowActive();
+        clipRefresh();
+        bracketRefresh();
+        windowStore(active);
+        for (int i = 0; i < windowCount(); i++) {
+            windowLoad(i);
+            drawingActive = i == active;
+            editorDrawRows(&ab);
+            windowStore(i);
+        }
+        windowLoad(active);
+        windowDrawSeparators(&ab);
+    }
+
+    E.dirtystart = 1;
+    E.dirtyend = 0;
+
     editorDrawStatusBar(&ab);
     editorDrawMessageBar(&ab);
 
     char cursorpos[15];
     size_t cursorposLen;
-    if (!E.message.isFocus)
+    if (!E.message.isFocus && hexActive()) {
+        int y, x;
+        hexCursor(&y, &x);
+        cursorposLen = snprintf(cursorpos, sizeof(cursorpos), "\x1b[%d;%dH", y + 1, x + 1);
+    } else if (!E.message.isFocus && S.softwrap) {
+        int line = wrapLineOf(&E.row[E.cy], E.rx);
+        int y = wrapDistance(E.rowoff, E.rowsub, E.cy, line, E.screenrows);
+        cursorposLen = snprintf(cursorpos, sizeof(cursorpos), "\x1b[%d;%dH", E.screentop + y + 1,
+                                E.screenleft + (E.rx - wrapStart(&E.row[E.cy], line)) + 1);
+    } else if (!E.message.isFocus)
         cursorposLen = snprintf(cursorpos, sizeof(cursorpos), "\x1b[%d;%dH",
-                                    (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
+                                    E.screentop + (E.cy - E.rowoff) + 1, E.screenleft + (E.rx - E.coloff) + 1);
     else {
         cursorposLen = snprintf(cursorpos, sizeof(cursorpos), "\x1b[%d;%dH",
                                     (E.message.cy) + 1, (E.message.cx) + 1);
@@ -666,129 +1119,268 @@ void editorOpenEmpty(void) {
     editorRowAppend(&line, linelen);
 }
 
-void editorOpen(const char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
+/*
+ * Description:
+ * Remembers the state of the file on disk, rows are clean afterwards
+ */
+void editorSyncFileState(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) die("In function: %s\r\nAt line: %d\r\nfstat", __func__, __LINE__);
+    E.fsize = st.st_size;
+    E.fmtime = st.st_mtim;
+    E.firstmoved = INT_MAX;
+
+    for (int i = 0; i < E.numrows; i++) {
+        E.row[i].osize = E.row[i].size;
+        E.row[i].flags &= ~ROW_DIRTY;
+    }
+}
+
+/*
+ * Description:
+ * Reads filename into E, creating it when it does not exist
+ * Returns 0 when it can be neither read nor created, E then has an empty row, errno and the message say why
+ */
+int editorOpen(const char *filename) {
+    allocFree(E.filename);
+    E.filename = allocString(ALLOC_IO, filename);
     if (!E.filename)
         die("In function: %s\r\nAt line: %d\r\nNo file name given", __func__, __LINE__);
 
     FILE *fp = fopen(E.filename, "r");
     if (!fp)
         fp = fopen(E.filename, "w");
+    if (!fp) {
+        int err = errno;
+        editorOpenEmpty();
+        editorSetMessage("Can not open %s: %s", E.filename, strerror(err));
+        errno = err;
+        return 0;
+    }
 
     ssize_t linelen = 0;
     size_t linecap = 0;
     char *line = NULL;
 
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
+    E.eolAtEof = 0;
+    int uniform = 1;
+    int indexed = loadIndexed(fileno(fp), &uniform);
+    while (!indexed && (linelen = getline(&line, &linecap, fp)) != -1) {
+        E.eolAtEof = linelen > 0 && line[linelen - 1] == '\n';
+        if (!E.numrows && E.eolAtEof)
+            strcpy(E.eol, linelen > 1 && line[linelen - 2] == '\r' ? "\r\n" : "\n");
+
+        ssize_t rawlen = linelen;
         while (linelen > 0 &&
             (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
             linelen--;
         }
+        if ((size_t) (rawlen - linelen) != (E.eolAtEof ? strlen(E.eol) : 0)) uniform = 0;
         editorRowAppend(line, linelen);
     }
 
     if (E.row == NULL) editorOpenEmpty(); /* Condition to make sure empty files are opened correctly */
 
+    editorSyncFileState(fileno(fp));
+    /* a line ending other than E.eol, or a stray '\r', moves the rows after it, the first save writes them all */
+    if (!uniform) E.firstmoved = 0;
+
     free(line);
     fclose(fp);
+    return 1;
 }
 
+/*
+ * Description:
+ * Writes rows from `from` till the end of buffer to fd starting at offset, through a fixed size buffer
+ * Returns offset after the last byte written
+ */
+off_t editorWriteRows(int fd, int from, off_t offset) {
+    char buf[1 << 16];
+    size_t used = 0;
+    size_t eollen = strlen(E.eol);
+
+    for (int curline = from; curline < E.numrows; curline++) {
+        const erow *row = &E.row[curline];
+        const char *chars = ROW_CHARS(row);
+        size_t left = row->size + (curline != E.numrows - 1 || E.eolAtEof ? eollen : 0);
+
+        for (size_t done = 0; done < left;) {
+            size_t n = left - done;
+            if (n > sizeof(buf) - used) n = sizeof(buf) - used;
+
+            /* the part before row->size comes from chars, the rest from the line terminator */
+            for (size_t k = 0; k < n; k++, done++)
+                buf[used + k] = done < row->size ? chars[done] : E.eol[done - row->size];
+            used += n;
+
+            if (used == sizeof(buf)) {
+                if (pwrite(fd, buf, used, offset) != (ssize_t) used)
+                    die("In function: %s\r\nAt line: %d\r\npwrite", __func__, __LINE__);
+                offset += used;
+                used = 0;
+            }
+        }
+    }
+
+    if (used && pwrite(fd, buf, used, offset) != (ssize_t) used)
+        die("In function: %s\r\nAt line: %d\r\npwrite", __func__, __LINE__);
+    return offset + used;
+}
+
+/*
+ * Description:
+ * Saves buffer to filename
+ * When the file is the one rows were loaded from and it was not changed by someone else since,
+ * rows that kept their size and position are written in place, only if they were modified.
+ * The file is rewritten from the first row that was resized, inserted or removed onwards
+ */
 void editorSave(const char *filename) {
     if (!filename) {
         editorSetMessage("File name is not set!");
         return;
     }
 
-    size_t writeSize = 0;
-    for (int curline = 0; curline < E.numrows - 1; curline++) {
-        writeSize += E.row[curline].size + 2;
-    }
-    writeSize += E.row[E.numrows - 1].size + 1;
-
-    FILE *file;
+    int fd;
     if (!E.message.isFocus) {
-        if (!(file = fopen(filename, "r+"))) {
+        if ((fd = open(filename, O_WRONLY)) == -1) {
             editorSetMessage("File does not exist");
             return;
         }
     } else {
-        file = fopen(filename, "w");
+        fd = open(filename, O_WRONLY | O_CREAT, 0644);
+        if (fd == -1) {
+            editorSetMessage("Can not open %s for writing", filename);
+            return;
+        }
     }
 
-    char *buf = (char *) malloc(writeSize);
-    if (buf == NULL) die("In function: %s\r\nAt line: %d\r\nmalloc", __func__, __LINE__);
-
-    size_t offset = 0;
-    for (int curline = 0; curline < E.numrows; curline++) {
-        const erow *row = &E.row[curline];
-        memcpy(buf + offset, row->chars, row->size);
-
-        if (curline != E.numrows - 1) {
-            buf[offset + row->size] = '\r';
-            buf[offset + row->size + 1] = '\n';
-            offset += row->size + 2;
-        } else 
-            buf[offset + row->size] = '\0';
+    int isSource = E.filename && !strcmp(filename, E.filename);
+    struct stat st;
+    if (fstat(fd, &st) == -1) die("In function: %s\r\nAt line: %d\r\nfstat", __func__, __LINE__);
+    int inPlace = isSource && st.st_size == E.fsize &&
+                  st.st_mtim.tv_sec == E.fmtime.tv_sec && st.st_mtim.tv_nsec == E.fmtime.tv_nsec;
+
+    size_t eollen = strlen(E.eol);
+    off_t offset = 0;
+    size_t written = 0;
+    int curline = 0;
+    if (inPlace) {
+        for (; curline < E.numrows && curline < E.firstmoved; curline++) {
+            const erow *row = &E.row[curline];
+            if (row->osize != row->size) break;
+            offset += row->size + (curline != E.numrows - 1 || E.eolAtEof ? eollen : 0);
+        }
+        /* rows that all kept their place add up to the file, otherwise it is not laid out as they say */
+        if (curline == E.numrows && offset != st.st_size) curline = offset = 0;
+
+        off_t at = 0;
+        for (int i = 0; i < curline; i++) {
+            const erow *row = &E.row[i];
+            if (row->flags & ROW_DIRTY) {
+                if (pwrite(fd, ROW_CHARS(row), row->size, at) != (ssize_t) row->size)
+                    die("In function: %s\r\nAt line: %d\r\npwrite", __func__, __LINE__);
+                written += row->size;
+            }
+            at += row->size + (i != E.numrows - 1 || E.eolAtEof ? eollen : 0);
+        }
     }
-    
-    if (writeSize > 1) {
-        size_t bytes = fwrite(buf, sizeof(char), writeSize - 1, file);
-        if (bytes < writeSize - 1) die("In function: %s\r\nAt line: %d\r\nfwrite", __func__, __LINE__);
+
+    if (curline < E.numrows) {
+        off_t end = editorWriteRows(fd, curline, offset);
+        written += end - offset;
+        offset = end;
     }
+    if (ftruncate(fd, offset) == -1) die("In function: %s\r\nAt line: %d\r\nftruncate", __func__, __LINE__);
+
+    if (isSource) editorSyncFileState(fd);
+    close(fd);
 
-    fclose(file);
-    free(buf);
-    editorSetMessage("Total of %ld bytes have been written to disk", writeSize - 1);
+    editorSetMessage("Total of %zu bytes have been written to disk", written);
 }
 
-void editorSaveAs(void) {
+/*
+ * Description:
+ * Takes a snapshot of the session, when its rows came from a file, and exits
+ */
+void editorQuit(void) {
+    if (!streamPending() && !followActive() && !hexActive()) sessionSave();
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    write(STDOUT_FILENO, "\x1b[H", 3);
+    exit(0);
+}
+
+/*
+ * Description:
+ * Shows `prompt` in the message bar and reads a line of input of at most `maxlen` characters
+ * If callback is not NULL, it is called with the input so far after every key that does not end the prompt
+ * Returns the input, or NULL when cancelled with ESC or when input exceeds `maxlen`
+ * CAUTION: The returned string should be freed by the caller
+ */
+char *editorPrompt(const char *prompt, int maxlen, void (*callback)(const char *input, int key)) {
     E.message.isFocus = 1;
-    int filenamesize = 0;
-    char *filename = NULL;
+    int inputsize = 0;
+    char *input = (char *) allocMem(ALLOC_IO, 1);
+    input[0] = '\0';
 
-    editorSetMessage("Enter file name: ");
+    editorSetMessage("%s", prompt);
     editorRefreshScreen();
 
     int c;
     while ((c = editorReadKey()) != '\r') {
-        if (filenamesize > S.maxFileNameSize) {
-            editorSetMessage("File name can not exceed %d characters", S.maxFileNameSize);
-            E.message.isFocus = 0;
-            E.message.time = time(NULL);
-            return;
-        }
-
         switch (c) {
             case '\x1b' :
-                free(filename);
+                allocFree(input);
                 E.message.isFocus = 0;
                 editorClearMessage();
-                return;
+                return NULL;
             case CTRL_KEY('q'): 
-                free(filename);
+                allocFree(input);
                 E.message.isFocus = 0;
                 editorClearMessage();
-                write(STDOUT_FILENO, "\x1b[2J", 4);
-                write(STDOUT_FILENO, "\x1b[H", 3);
-                exit(0);
+                editorQuit();
+                break;
+            case BACKSPACE:
+                if (inputsize) {
+                    input[--inputsize] = '\0';
+                    E.message.data[--E.message.length] = '\0';
+                    E.message.cx--;
+                }
+                break;
             default:
                 if (isprint(c)) {
-                    filename = (char *) realloc(filename, filenamesize + 2);
-                    if (!filename) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
-                    filename[filenamesize] = c;
-                    filenamesize++;
-                    filename[filenamesize] = '\0';
-                    editorAppendMessage((char *) &c, 1);
+                    if (inputsize >= maxlen) {
+                        allocFree(input);
+                        editorSetMessage("Input can not exceed %d characters", maxlen);
+                        E.message.isFocus = 0;
+                        return NULL;
+                    }
 
-                    editorRefreshScreen();
+                    input = (char *) allocResize(ALLOC_IO, input, inputsize + 2);
+                    input[inputsize] = c;
+                    inputsize++;
+                    input[inputsize] = '\0';
+                    editorAppendMessage((char *) &c, 1);
                 }
         }
+
+        if (callback) callback(input, c);
+        editorRefreshScreen();
     }
 
+    E.message.isFocus = 0;
+    editorClearMessage();
+    return input;
+}
+
+void editorSaveAs(void) {
+    char *filename = editorPrompt("Enter file name: ", S.maxFileNameSize, NULL);
+    if (!filename) return;
+
+    if (!E.filename) E.filename = allocString(ALLOC_IO, filename);
+    E.message.isFocus = 1;
     editorSave(filename);
-    if (!E.filename) E.filename = strdup(filename);
-    free(filename);
+    allocFree(filename);
 
     E.message.isFocus = 0;
 }
@@ -837,7 +1429,7 @@ void editorMoveCursor(int c) {
                 E.cx = 0;
                 E.rx = 0;
                 E.max_rx = 0;
-            } else if (row->chars[E.cx] == '\t') {
+            } else if (ROW_CHARS(row)[E.cx] == '\t') {
                 E.rx += S.tabwidth - (E.rx % S.tabwidth);
                 E.cx++;
                 E.max_rx = E.rx;
@@ -849,8 +1441,8 @@ void editorMoveCursor(int c) {
             break;
         }
         case ARROW_LEFT: {
-            const erow *curRow = &E.row[E.cy];
-            const char *chars = curRow->chars;
+            erow *curRow = &E.row[E.cy];
+            const char *chars = ROW_CHARS(curRow);
 
             if (E.cx == 0 && E.cy == 0)
                 break;
@@ -877,7 +1469,7 @@ void editorMoveCursor(int c) {
                     int extraSpaces = spaceCount % S.tabwidth;
                     deltaRx = S.tabwidth - extraSpaces;
                 } else {
-                    const char *render = curRow->render;
+                    const char *render = editorRowRender(curRow);
                     int rx = cx;
                     while (render[E.rx - rx] != chars[E.cx - cx]) {
                         rx++;
@@ -931,8 +1523,258 @@ void editorMoveCursor(int c) {
     }
 }
 
+/* Shows filename in the hex view, over the buffer which is kept as it is */
+void editorHexOpen(const char *filename) {
+    H.commit();
+    if (!hexOpen(filename)) editorSetMessage("Can not map %s", filename);
+    else editorSetMessage("Hex view: Tab hex/text, Ctrl+O write, Ctrl+X g offset, Ctrl+X h leave");
+}
+
+/*
+ * Description:
+ * Handles the key following the Ctrl-X prefix
+ */
+void editorProcessCommand(int c) {
+    switch (c) {
+        case '(':
+            if (macroIsRecording() || macroIsReplaying()) break;
+            macroStartRecording();
+            editorSetMessage("Recording macro, Ctrl+X ) to stop");
+            break;
+        case ')':
+            if (!macroIsRecording()) break;
+            macroStopRecording();
+            editorSetMessage("Macro recorded");
+            break;
+        case 'e': {
+            if (macroIsRecording() || macroIsReplaying()) {
+                editorSetMessage("Can not replay a macro while recording one");
+                break;
+            }
+
+            char *input = editorPrompt("Replay macro how many times: ", 9, NULL);
+            if (!input) break;
+            int times = input[0] ? atoi(input) : 1;
+            allocFree(input);
+            if (times <= 0) break;
+
+            H.commit();
+            macroReplay(times);
+            E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+            editorSetMessage("Macro replayed %d times", times);
+            break;
+        }
+        case 'r':
+        case 'R': {
+            char *pattern = editorPrompt(c == 'r' ? "Replace: " : "Replace (ignore case): ", S.maxMsgSize / 2, NULL);
+            if (!pattern) break;
+            char *replacement = editorPrompt("With: ", S.maxMsgSize / 2, NULL);
+            if (!replacement) {
+                allocFree(pattern);
+                break;
+            }
+
+            int count = editorReplaceAll(pattern, replacement, c == 'R');
+            allocFree(pattern);
+            allocFree(replacement);
+
+            if (E.cx > (int) E.row[E.cy].size) E.cx = E.row[E.cy].size;
+            E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+            E.max_rx = E.rx;
+            editorSetMessage("Replaced %d occurrences", count);
+            break;
+        }
+        case '|': {
+            char *input = editorPrompt("Filter through ([from,to] command): ", S.maxMsgSize, NULL);
+            if (!input) break;
+
+            /* An optional 1-based line range in front of the command, the whole buffer otherwise */
+            int from = 1, to = E.numrows;
+            char *command = input;
+            int n = 0;
+            if (sscanf(input, " %d,%d %n", &from, &to, &n) == 2 && n) command = input + n;
+            else from = 1, to = E.numrows;
+            if (from < 1) from = 1;
+            if (to > E.numrows) to = E.numrows;
+            if (!*command || from > to) {
+                allocFree(input);
+                break;
+            }
+
+            H.commit();
+            int status = editorFilter(from - 1, to - 1, command);
+            allocFree(input);
+
+            E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+            E.max_rx = E.rx;
+            if (status == -1) editorSetMessage("Filter failed or was cancelled");
+            else editorSetMessage("Filtered %d lines, command exited with %d", to - from + 1, status);
+            break;
+        }
+        case 't': {
+            char *input = editorPrompt("Go to state as of how many minutes ago: ", 9, NULL);
+            if (!input) break;
+            double minutes = atof(input);
+            allocFree(input);
+            if (minutes < 0) break;
+
+            long state = H.travel(time(NULL) - (time_t) (minutes * 60));
+            if (state < 0) break;
+            E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+            E.max_rx = E.rx;
+            editorSetMessage("At state %ld", state);
+            break;
+        }
+        case 'b': {
+            int count;
+            int nth = H.branch(&count);
+            if (count) editorSetMessage("Redo follows branch %d of %d", nth, count);
+            else editorSetMessage("No branch to redo from here");
+            break;
+        }
+        case 'w':
+            S.softwrap = !S.softwrap;
+            windowLayout();
+            editorSetMessage("Soft wrap %s", S.softwrap ? "on" : "off");
+            break;
+        case '2':
+        case '3':
+            if (!windowSplit(c == '3')) editorSetMessage("Window is too small to split");
+            break;
+        case 'o':
+            H.commit();
+            windowNext();
+            break;
+        case '0':
+            windowClose();
+            break;
+        case 'f': {
+            char *filename = editorPrompt("Open file: ", S.maxFileNameSize, NULL);
+            if (!filename) break;
+            if (!filename[0]) editorSetMessage("No file name given");
+            else if (hexDetect(filename)) editorHexOpen(filename);
+            else if (!bufferOpen(filename)) editorSetMessage("Wait for stdin to be read before opening files");
+            allocFree(filename);
+            break;
+        }
+        case 's':
+            editorGrep();
+            break;
+        case 'n':
+        case 'p': {
+            int next = (bufferActive() + (c == 'n' ? 1 : bufferCount() - 1)) % bufferCount();
+            if (!bufferSwitch(next)) editorSetMessage("Wait for stdin to be read before switching buffers");
+            break;
+        }
+        case 'h':
+            if (!E.filename) editorSetMessage("No file to view in hex");
+            else editorHexOpen(E.filename);
+            break;
+        case 'F':
+            if (followActive()) {
+                followStop();
+                editorSetMessage("Follow off");
+            } else if (streamPending()) {
+                editorSetMessage("Wait for stdin to be read before following a file");
+            } else if (!E.filename) {
+                editorSetMessage("No file to follow");
+            } else if (followStart()) {
+                E.cy = E.numrows - 1;
+                E.cx = E.rx = E.max_rx = 0;
+                editorSetMessage("Following %s, moving off the last line stops scrolling", E.filename);
+            } else {
+                editorSetMessage("Can not follow %s: %s", E.filename, strerror(errno));
+            }
+            break;
+        case 'm':
+            editorSetMessage(clipMark() ? "Mark set" : "Mark cleared");
+            break;
+        case 'c': {
+            int count = clipCopy();
+            if (count) editorSetMessage("Copied %d lines", count);
+            else editorSetMessage("Nothing selected, Ctrl-X m sets the mark");
+            break;
+        }
+        case 'x': {
+            int count = clipCut();
+            if (count) editorSetMessage("Cut %d lines", count);
+            else editorSetMessage("Nothing selected, Ctrl-X m sets the mark");
+            E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+            E.max_rx = E.rx;
+            break;
+        }
+        case 'v': {
+            int count = clipPaste();
+            if (!count) editorSetMessage("Clipboard is empty");
+            E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+            E.max_rx = E.rx;
+            break;
+        }
+        case 'i': {
+            char stats[256];
+            int len = inputStats(stats, sizeof(stats));
+            len += snprintf(stats + len, sizeof(stats) - len, " | ");
+            idleStats(stats + len, sizeof(stats) - len);
+            editorSetMessage("%s", stats);
+            break;
+        }
+        case 'j':
+            if (!bracketJump()) editorSetMessage("No matching bracket at the cursor");
+            break;
+        case 'l': {
+            char list[256];
+            bufferList(list, sizeof(list));
+            editorSetMessage("%s", list);
+            break;
+        }
+    }
+}
+
+/*
+ * Description:
+ * Keys while the hex view is shown, only quitting, saving and the hex view's own commands leave the view
+ */
+void editorProcessHexKey(int c) {
+    switch (c) {
+        case CTRL_KEY('q'):
+            editorQuit();
+            break;
+        case CTRL_KEY('o'): {
+            int written = hexSave();
+            if (written < 0) editorSetMessage("Can not write bytes: %s", strerror(errno));
+            else editorSetMessage("%d bytes written to disk", written);
+            break;
+        }
+        case CTRL_KEY('x'): {
+            int k = editorReadKey();
+            if (k == 'h') {
+                if (hexClose(0)) windowLayout();
+                else editorSetMessage("Bytes are not written, Ctrl+O writes them, Ctrl+X h again drops them");
+            } else if (k == 'g') {
+                char *input = editorPrompt("Go to offset: ", 20, NULL);
+                if (!input) break;
+                char *end;
+                errno = 0;
+                unsigned long long off = strtoull(input, &end, 0);
+                if (!input[0] || *end || errno || !hexGoto(off)) editorSetMessage("No offset %s in file", input);
+                allocFree(input);
+            } else {
+                editorSetMessage("Not available in hex view");
+            }
+            break;
+        }
+        default:
+            hexProcessKey(c);
+            break;
+    }
+}
+
 void editorProcessKeyPress(void) {
     int c = editorReadKey();
+    if (hexActive()) {
+        editorProcessHexKey(c);
+        return;
+    }
 
     // TODO: undo time check
     // if time > threshold
@@ -940,9 +1782,7 @@ void editorProcessKeyPress(void) {
 
     switch (c) {
         case CTRL_KEY('q'):
-            write(STDOUT_FILENO, "\x1b[2J", 4);
-            write(STDOUT_FILENO, "\x1b[H", 3);
-            exit(0);
+            editorQuit();
             break;
         case CTRL_KEY('o'):
             editorSave(E.filename);
@@ -958,6 +1798,13 @@ void editorProcessKeyPress(void) {
             H.redo();
             E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
             break;
+        case CTRL_KEY('f'):
+            H.commit();
+            editorFind();
+            break;
+        case CTRL_KEY('x'):
+            editorProcessCommand(editorReadKey());
+            break;
         case ARROW_UP:
         case ARROW_DOWN:
         case ARROW_LEFT:
@@ -972,6 +1819,8 @@ void editorProcessKeyPress(void) {
             editorMoveCursor(c);
             break;
         case '\r':
+            if (grepVisit()) break;
+
             // TODO: commit action
             // set another action
             // commit action
@@ -980,16 +1829,16 @@ void editorProcessKeyPress(void) {
             editorRowInsertBefore(E.cy, E.cx);
             break;
         case DELETE_KEY: {
-            char charRemoved;
+            char charRemoved[2] = "\0";
             int length = -1; // Since it is Delete key
             // TODO: if action type change
             // commit action
             if (E.cx == (int) E.row[E.cy].size && E.cy < E.numrows) {
-                charRemoved = '\n';
-                H.record(REMOVE_LINE_AFT, &charRemoved, length, E.cx, E.cy);
+                charRemoved[0] = '\n';
+                H.record(REMOVE_LINE_AFT, charRemoved, length, E.cx, E.cy);
             } else {
-                charRemoved = E.row[E.cy].chars[E.cx];
-                H.record(REMOVE_CHAR_AFT, &charRemoved, length, E.cx, E.cy);
+                charRemoved[0] = ROW_CHARS(&E.row[E.cy])[E.cx];
+                H.record(REMOVE_CHAR_AFT, charRemoved, length, E.cx, E.cy);
             }
 
             editorRemoveChars(E.cy, E.cx, -1);
@@ -1012,7 +1861,7 @@ void editorProcessKeyPress(void) {
                     H.record(REMOVE_LINE_BEF, charRemoved, length, E.row[E.cy - 1].size, E.cy); 
                 }
             } else {
-                charRemoved[0] = E.row[E.cy].chars[E.cx - 1];
+                charRemoved[0] = ROW_CHARS(&E.row[E.cy])[E.cx - 1];
                 H.record(REMOVE_CHAR_BEF, charRemoved, length, E.cx, E.cy);
             }
 
@@ -1043,9 +1892,22 @@ void initEditor(void) {
     E.row = NULL;
     E.numrows = 0;
     E.rowoff = 0;
+    E.rowsub = 0;
     E.coloff = 0;
     E.max_rx = 0;
     E.filename = NULL;
+    strcpy(E.eol, "\n");
+    E.eolAtEof = 0;
+    E.firstmoved = INT_MAX;
+    E.fsize = 0;
+    E.fmtime = (struct timespec) {0, 0};
+
+    E.prevrowoff = -1;
+    E.prevrowsub = 0;
+    E.prevcoloff = 0;
+    E.prevwelcome = 0;
+    E.dirtystart = 1;
+    E.dirtyend = 0;
 
     E.message = (struct editorMsg) { NULL, 0, 0, 0, 0, 0 };
 
@@ -1054,31 +1916,78 @@ void initEditor(void) {
     S.tabwidth = 4;
     S.maxFileNameSize = 40;
     S.maxMsgSize = 80;
-    S.maxHistory = 10;
+    S.softwrap = 0;
+    S.maxHistory = 1000;
+    S.checkpointInterval = 256;
+    S.maxCheckpoints = 8;
+    S.bufferBudget = (size_t) 64 << 20;
+    S.internRows = 0;
     S.maxActionTime = 5;
 
     /* Editor History */
     historyInit();
 
     enableRawMode();
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1)
+    if (getWindowSize(&E.termrows, &E.termcols) == -1)
         die("In function: %s\r\nAt line: %d", __func__, __LINE__);
-    E.screenrows -= 2;
+    inputStart(); /* after the window size is known, the terminal may have been asked for it */
+
+    /* Editor Windows */
+    windowInit();
+    windowResizeInit();
+
+    /* Editor Buffers */
+    bufferInit();
+
+    /* Background work */
+    idleAdd(&streamTask);
+    idleAdd(&searchTask);
+    idleAdd(&followTask);
+    idleAdd(&resizeTask);
+    idleAdd(&grepTask);
 }
 
 int main(int argc, char *argv[]) {
+    allocInit();
+
+    int intern = argc >= 3 && !strcmp(argv[1], "-i");
+    if (intern) argv++, argc--;
+    int fromStdin = argc >= 2 && !strcmp(argv[1], "-");
+    int follow = argc >= 3 && !strcmp(argv[1], "-f");
+    if (follow) argv++, argc--;
+    int restored = 0;
+    int opened = 1; /* cleared when the file given can not be opened, the message says why */
+    if (fromStdin) streamOpenStdin(); /* before the terminal is set up, stdin is the pipe until then */
+
     initEditor();
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    S.internRows = intern;
+    if (fromStdin) {
+        editorOpenEmpty();
+    } else if (argc >= 2 && hexDetect(argv[1])) {
+        /* binary files are not split into rows, they are only shown in the hex view */
+        editorOpenEmpty();
+        editorHexOpen(argv[1]);
+    } else if (argc >= 2 && follow) {
+        opened = editorOpen(argv[1]);
+        if (opened && followStart()) E.cy = E.numrows - 1;
+    } else if (argc >= 2) {
+        restored = sessionLoad(argv[1]);
+        loadPreview(1);
+        if (!restored) opened = editorOpen(argv[1]);
+        loadPreview(0);
     } else {
         editorOpenEmpty();
     }
 
-    editorSetMessage("Help: Ctrl+Q=Quit    Ctrl+O=Save    Ctrl+W=Save As    Ctrl+U=Undo    Ctrl+R=Redo");
+    if (restored)
+        editorSetMessage("Session restored: edits, undo history and cursor are as they were on quit");
+    else if (opened)
+        editorSetMessage("Help: Ctrl+Q=Quit    Ctrl+O=Save    Ctrl+W=Save As    Ctrl+U=Undo    Ctrl+R=Redo");
 
     while (1) {
         editorRefreshScreen();
         editorProcessKeyPress();
+        H.sync();
     }
 
     return 0;
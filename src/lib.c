@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "lib.h"
+#include "alloc.h"
 
 void die(char *s, ...) {
     va_list ap;
@@ -24,8 +25,7 @@ void die(char *s, ...) {
  */
 void stringSlice(char **s, size_t slen, size_t rlen, int from) {
     if (rlen >= slen) {
-        *s = realloc(*s, 1);
-        if (!*s) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+        *s = allocResize(ALLOC_IO, *s, 1);
         (*s)[0] = '\0';
         return;
     }
@@ -36,8 +36,7 @@ void stringSlice(char **s, size_t slen, size_t rlen, int from) {
 
     size_t nlen = slen - rlen;
     memmove(*s + from, *s + from + rlen, rlen);
-    *s = realloc(*s, nlen + 1);
-    if (!*s) die("In function: %s\r\nAt line: %d\r\nrealloc", __func__, __LINE__);
+    *s = allocResize(ALLOC_IO, *s, nlen + 1);
     (*s)[nlen] = '\0';
 }
 
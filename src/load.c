@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "intern.h"
+#include "load.h"
+
+#define LOAD_MAX_THREADS 64
+#define LOAD_CHUNK_MIN (1 << 20) /* smallest part of a file given to a thread of its own */
+#define LOAD_ENV "KILO_LOAD_CHUNKS" /* number of chunks to cut every file in, whatever its size and the cores */
+
+/*
+ * A file is mapped and cut into one chunk per core, every chunk starting at the beginning of a line
+ * A line longer than a chunk stretches the chunk it starts in, the chunks it swallows are left out
+ * Each chunk is scanned for newlines on a thread of its own, which notes where its lines end and turns
+ * them into rows. The UI thread takes the first chunk, so its rows are in the buffer, and on screen
+ * at start, while the other chunks are still being scanned
+ * Row numbers of the other chunks come from a prefix sum of the line counts before them, the rows are
+ * moved into place in one go once every chunk is done
+ * Interned rows go through a single table, with S.internRows they are made on the UI thread from the
+ * line ends found by the workers
+ */
+typedef struct {
+    pthread_t thread;
+    const char *map;
+    size_t from, to; /* offsets in the file, from is the start of a line */
+    int last;        /* the chunk ends at the end of the file, bytes after its last newline make a row too */
+
+    size_t *ends; /* offset of the newline, or end of the file, ending every line of the chunk */
+    int count;
+    int capacity;
+    erowList *rows; /* NULL until made */
+    int mixed;      /* a line of the chunk does not end with E.eol, or has a stray '\r' before it */
+} LoadChunk;
+
+static struct {
+    int preview; /* the first chunk is drawn before the others are done */
+} L = {0};
+
+/*
+ * Description:
+ * Draws the rows of the first chunk of a file opened by editorOpen() while the rest is being indexed
+ * Only meant for the file opened at start, when the buffer is the one shown by the only window
+ */
+void loadPreview(int on) {
+    L.preview = on;
+}
+
+static void loadScan(LoadChunk *c) {
+    const char *p = c->map + c->from;
+    const char *end = c->map + c->to;
+    while (p < end) {
+        const char *nl = (const char *) memchr(p, '\n', end - p);
+        if (!nl && !c->last) break;
+        if (c->count == c->capacity) {
+            c->capacity = c->capacity ? c->capacity * 2 : 4096;
+            c->ends = (size_t *) allocResize(ALLOC_IO, c->ends, sizeof(size_t) * c->capacity);
+        }
+        c->ends[c->count++] = (nl ? nl : end) - c->map;
+        if (!nl) break;
+        p = nl + 1;
+    }
+}
+
+/* Rows of the lines of c, carriage returns before the newline are dropped like editorOpen() does */
+static void loadRows(LoadChunk *c) {
+    c->rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * c->count);
+    c->rows->count = c->count;
+    size_t crs = strlen(E.eol) - 1;
+    size_t start = c->from;
+    for (int i = 0; i < c->count; i++) {
+        size_t len = c->ends[i] - start;
+        while (len && c->map[start + len - 1] == '\r') len--;
+        if (c->ends[i] - start - len != (c->ends[i] < c->to ? crs : 0)) c->mixed = 1;
+        if (S.internRows) internRow(&c->rows->rows[i], c->map + start, len);
+        else editorRowSet(&c->rows->rows[i], c->map + start, len);
+        start = c->ends[i] + 1;
+    }
+}
+
+static void *loadWorker(void *arg) {
+    LoadChunk *c = (LoadChunk *) arg;
+    loadScan(c);
+    if (!S.internRows) loadRows(c);
+    return NULL;
+}
+
+/* Start of the first line beginning at or after offset at */
+static size_t loadLineStart(const char *map, size_t size, size_t at) {
+    if (!at || map[at - 1] == '\n') return at;
+    const char *nl = (const char *) memchr(map + at, '\n', size - at);
+    return nl ? (size_t) (nl - map) + 1 : size;
+}
+
+/*
+ * Description:
+ * Reads the rows of the regular file fd into E, with newlines looked for on a thread per core
+ * uniform is cleared when a line does not end with E.eol, the rows are not where E.eol puts them in the file
+ * Returns 0 when fd is empty or can not be mapped, for the caller to read it the usual way
+ */
+int loadIndexed(int fd, int *uniform) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || !st.st_size) return 0;
+    size_t size = st.st_size;
+    const char *map = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return 0;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t parts = size / LOAD_CHUNK_MIN;
+    const char *forced = getenv(LOAD_ENV);
+    if (forced && atoi(forced) > 0) {
+        cores = atoi(forced);
+        parts = size;
+    }
+    int n = cores < 1 ? 1 : cores > LOAD_MAX_THREADS ? LOAD_MAX_THREADS : (int) cores;
+    if (parts < (size_t) n) n = parts ? (int) parts : 1;
+
+    /* split points are moved to the next line start, empty chunks are dropped */
+    LoadChunk chunks[LOAD_MAX_THREADS];
+    int count = 0;
+    for (size_t from = 0, i = 0; from < size; i++) {
+        size_t to = (int) i == n - 1 ? size : loadLineStart(map, size, size / n * (i + 1));
+        if (to <= from) continue;
+        memset(&chunks[count], 0, sizeof(LoadChunk));
+        chunks[count].map = map;
+        chunks[count].from = from;
+        chunks[count].to = to;
+        chunks[count].last = to == size;
+        count++;
+        from = to;
+    }
+    n = count;
+
+    /* workers compare line endings with E.eol */
+    const char *nl = (const char *) memchr(map, '\n', size);
+    if (nl) strcpy(E.eol, nl > map && nl[-1] == '\r' ? "\r\n" : "\n");
+    E.eolAtEof = map[size - 1] == '\n';
+
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&chunks[i].thread, NULL, loadWorker, &chunks[i]))
+            die("In function: %s\r\nAt line: %d\r\npthread_create", __func__, __LINE__);
+    }
+
+    loadScan(&chunks[0]);
+    loadRows(&chunks[0]);
+    editorRowsFree(editorRowsReplace(E.numrows, 0, chunks[0].rows));
+    if (L.preview && n > 1 && E.numrows) {
+        editorSetMessage("Indexing %s on %d threads...", E.filename, n);
+        editorRefreshScreen();
+    }
+
+    /* row of the first line of every chunk, relative to the end of the first one */
+    int total = 0;
+    int starts[LOAD_MAX_THREADS];
+    for (int i = 1; i < n; i++) {
+        pthread_join(chunks[i].thread, NULL);
+        if (!chunks[i].rows) loadRows(&chunks[i]);
+        starts[i] = total;
+        total += chunks[i].count;
+    }
+
+    erowList *rest = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * total);
+    rest->count = total;
+    for (int i = 1; i < n; i++) {
+        memcpy(rest->rows + starts[i], chunks[i].rows->rows, sizeof(erow) * chunks[i].count);
+        allocFree(chunks[i].rows);
+    }
+    editorRowsFree(editorRowsReplace(E.numrows, 0, rest));
+
+    for (int i = 0; i < n; i++) {
+        allocFree(chunks[i].ends);
+        if (chunks[i].mixed) *uniform = 0;
+    }
+    munmap((void *) map, size);
+    return 1;
+}
@@ -0,0 +1,91 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "history.h"
+#include "macro.h"
+
+/*** keyboard macros ***/
+static struct {
+    int *keys;
+    int length;
+    int capacity;
+    int recording;
+
+    int replaying;
+    int pos; /* next key to be fed while replaying */
+} M = {NULL, 0, 0, 0, 0, 0};
+
+void macroStartRecording(void) {
+    M.length = 0;
+    M.recording = 1;
+}
+
+/*
+ * Description:
+ * Stops recording, the 2 keys of the stop command (prefix + key) itself are dropped from the macro
+ */
+void macroStopRecording(void) {
+    if (!M.recording) return;
+    M.recording = 0;
+    M.length = M.length >= 2 ? M.length - 2 : 0;
+}
+
+int macroIsRecording(void) {
+    return M.recording;
+}
+
+int macroIsReplaying(void) {
+    return M.replaying;
+}
+
+void macroRecordKey(int c) {
+    if (!M.recording) return;
+
+    if (M.length == M.capacity) {
+        M.capacity = M.capacity ? 2 * M.capacity : 64;
+        M.keys = (int *) allocResize(ALLOC_IO, M.keys, sizeof(int) * M.capacity);
+    }
+    M.keys[M.length++] = c;
+}
+
+/*
+ * Description:
+ * Feeds the next recorded key while replaying
+ * Returns 0 when not replaying, otherwise 1 with *c set; once the macro is exhausted *c is ESC,
+ * so that a prompt waiting for more input than was recorded gets cancelled
+ */
+int macroNextKey(int *c) {
+    if (!M.replaying) return 0;
+    *c = M.pos < M.length ? M.keys[M.pos++] : '\x1b';
+    return 1;
+}
+
+/*
+ * Description:
+ * Runs the recorded keys `times` times without repainting in between
+ * All edits are grouped into one history entry, the caller renders a single frame afterwards
+ */
+void macroReplay(int times) {
+    if (M.recording || M.replaying || !M.length) return;
+
+    M.replaying = 1;
+    H.begin();
+    for (int i = 0; i < times; i++) {
+        M.pos = 0;
+        while (M.pos < M.length)
+            editorProcessKeyPress();
+    }
+    H.end();
+    M.replaying = 0;
+}
+
+void macroDelete(void) {
+    allocFree(M.keys);
+    M.keys = NULL;
+    M.length = M.capacity = 0;
+}
@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+#include "alloc.h"
+#include "types.h"
+#include "editor.h"
+#include "history.h"
+#include "replace.h"
+
+/*
+ * A REPLACE_TEXT action's data is a single block: a header, then the match positions, then the texts
+ * Texts are stored once when they are the same for every match (the pattern/replacement),
+ * or once per match when they differ (text matched while ignoring case)
+ */
+typedef struct {
+    int row, col; /* col is the position in the row before the replace */
+} ReplaceMatch;
+
+typedef struct {
+    size_t count;
+    size_t oldlen, newlen;
+    int oldPerMatch, newPerMatch;
+    size_t oldoff, newoff; /* offsets of the texts from start of the block */
+} ReplaceRecord;
+
+#define RECORD_MATCHES(rec) ((ReplaceMatch *) ((char *) (rec) + sizeof(ReplaceRecord)))
+#define RECORD_OLD(rec, i) ((char *) (rec) + (rec)->oldoff + ((rec)->oldPerMatch ? (i) * (rec)->oldlen : 0))
+#define RECORD_NEW(rec, i) ((char *) (rec) + (rec)->newoff + ((rec)->newPerMatch ? (i) * (rec)->newlen : 0))
+
+/*
+ * Description:
+ * Returns the position of first occurrence of pat in s at or after `from`, or -1
+ */
+static ssize_t findLiteral(const char *s, size_t slen, size_t from, const char *pat, size_t plen, int ignoreCase) {
+    if (plen > slen) return -1;
+
+    if (!ignoreCase) {
+        const char *p = memmem(s + from, slen - from, pat, plen);
+        return p ? p - s : -1;
+    }
+
+    int first = tolower((unsigned char) pat[0]);
+    for (size_t i = from; i + plen <= slen; i++) {
+        if (tolower((unsigned char) s[i]) != first) continue;
+        if (!strncasecmp(s + i + 1, pat + 1, plen - 1)) return i;
+    }
+    return -1;
+}
+
+/*
+ * Description:
+ * Rebuilds every row touched by rec in a single pass, replacing old text at each match with new text
+ * Matches are sorted by row then col and do not overlap
+ */
+static void replaceApply(ReplaceRecord *rec) {
+    ReplaceMatch *matches = RECORD_MATCHES(rec);
+    ssize_t delta = (ssize_t) rec->newlen - (ssize_t) rec->oldlen;
+
+    size_t i = 0;
+    while (i < rec->count) {
+        int at = matches[i].row;
+        size_t j = i;
+        while (j < rec->count && matches[j].row == at) j++;
+
+        erow *row = &E.row[at];
+        const char *old = ROW_CHARS(row);
+        size_t nsize = row->size + (j - i) * delta;
+        char *chars = (char *) allocMem(ALLOC_ROWS, nsize + 1);
+
+        size_t src = 0, dst = 0;
+        for (size_t k = i; k < j; k++) {
+            size_t col = matches[k].col;
+            memcpy(chars + dst, old + src, col - src);
+            dst += col - src;
+            memcpy(chars + dst, RECORD_NEW(rec, k), rec->newlen);
+            dst += rec->newlen;
+            src = col + rec->oldlen;
+        }
+        memcpy(chars + dst, old + src, row->size - src);
+        chars[nsize] = '\0';
+
+        editorRowAdopt(row, chars, nsize);
+
+        i = j;
+    }
+}
+
+/*
+ * Description:
+ * Converts rec into its inverse: positions become those in the replaced rows and old/new texts swap
+ */
+static void replaceFlip(ReplaceRecord *rec) {
+    ReplaceMatch *matches = RECORD_MATCHES(rec);
+    ssize_t delta = (ssize_t) rec->newlen - (ssize_t) rec->oldlen;
+
+    int nth = 0;
+    for (size_t i = 0; i < rec->count; i++) {
+        nth = (i && matches[i].row == matches[i - 1].row) ? nth + 1 : 0;
+        matches[i].col += nth * delta;
+    }
+
+    size_t len = rec->oldlen; rec->oldlen = rec->newlen; rec->newlen = len;
+    int perMatch = rec->oldPerMatch; rec->oldPerMatch = rec->newPerMatch; rec->newPerMatch = perMatch;
+    size_t off = rec->oldoff; rec->oldoff = rec->newoff; rec->newoff = off;
+}
+
+/*
+ * Description:
+ * Turns act into its inverse without touching the buffer
+ */
+void replaceInvert(Action *act) {
+    replaceFlip((ReplaceRecord *) act->data);
+}
+
+/*
+ * Description:
+ * Returns the size of the data block of a REPLACE_TEXT action
+ */
+size_t replaceSize(const Action *act) {
+    const ReplaceRecord *rec = (const ReplaceRecord *) act->data;
+    size_t oldend = rec->oldoff + (rec->oldPerMatch ? rec->count : 1) * rec->oldlen;
+    size_t newend = rec->newoff + (rec->newPerMatch ? rec->count : 1) * rec->newlen;
+    return (oldend > newend ? oldend : newend) + 1;
+}
+
+/*
+ * Description:
+ * Checks that the size bytes at data hold a REPLACE_TEXT block, with matches in the first rows rows and cols columns
+ * The block may be unaligned, it is only read through copies
+ */
+int replaceValid(const char *data, size_t size, size_t rows, size_t cols) {
+    ReplaceRecord rec;
+    if (size < sizeof(rec)) return 0;
+    memcpy(&rec, data, sizeof(rec));
+    if (rec.count > (size - sizeof(rec)) / sizeof(ReplaceMatch)) return 0;
+
+    size_t nold = rec.oldPerMatch ? rec.count : 1, nnew = rec.newPerMatch ? rec.count : 1;
+    if (rec.oldoff > size || (rec.oldlen && nold > (size - rec.oldoff) / rec.oldlen)) return 0;
+    if (rec.newoff > size || (rec.newlen && nnew > (size - rec.newoff) / rec.newlen)) return 0;
+
+    for (size_t i = 0; i < rec.count; i++) {
+        ReplaceMatch m;
+        memcpy(&m, data + sizeof(rec) + i * sizeof(m), sizeof(m));
+        if (m.row < 0 || (size_t) m.row >= rows || m.col < 0 || (size_t) m.col > cols) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Description:
+ * Undoes the replace described by act and turns act into its inverse, used by both undo and redo
+ */
+void replacePerform(Action *act) {
+    ReplaceRecord *rec = (ReplaceRecord *) act->data;
+    replaceFlip(rec);
+    replaceApply(rec);
+
+    E.cy = RECORD_MATCHES(rec)[0].row;
+    E.cx = RECORD_MATCHES(rec)[0].col;
+}
+
+/*
+ * Description:
+ * Replaces every occurrence of pattern in the buffer with replacement
+ * Only rows containing a match are rebuilt, and the whole replace is recorded as one undo action
+ * Returns number of occurrences replaced
+ */
+int editorReplaceAll(const char *pattern, const char *replacement, int ignoreCase) {
+    size_t plen = strlen(pattern), rlen = strlen(replacement);
+    if (!plen) return 0;
+
+    /* collect matches first, so that the record is sized exactly */
+    ReplaceMatch *matches = NULL;
+    size_t count = 0, capacity = 0;
+    for (int y = 0; y < E.numrows; y++) {
+        const erow *row = &E.row[y];
+        ssize_t at = 0;
+        while ((at = findLiteral(ROW_CHARS(row), row->size, at, pattern, plen, ignoreCase)) != -1) {
+            if (count == capacity) {
+                capacity = capacity ? 2 * capacity : 64;
+                matches = (ReplaceMatch *) allocResize(ALLOC_SEARCH, matches, sizeof(ReplaceMatch) * capacity);
+            }
+            matches[count++] = (ReplaceMatch) {y, at};
+            at += plen;
+        }
+    }
+    if (!count) {
+        allocFree(matches);
+        return 0;
+    }
+
+    size_t oldsize = ignoreCase ? count * plen : plen;
+    size_t size = sizeof(ReplaceRecord) + count * sizeof(ReplaceMatch) + oldsize + rlen + 1;
+    ReplaceRecord *rec = (ReplaceRecord *) allocMem(ALLOC_HISTORY, size);
+
+    *rec = (ReplaceRecord) {
+        .count = count, .oldlen = plen, .newlen = rlen,
+        .oldPerMatch = ignoreCase, .newPerMatch = 0,
+        .oldoff = sizeof(ReplaceRecord) + count * sizeof(ReplaceMatch),
+    };
+    rec->newoff = rec->oldoff + oldsize;
+    memcpy(RECORD_MATCHES(rec), matches, count * sizeof(ReplaceMatch));
+    allocFree(matches);
+
+    if (ignoreCase) {
+        ReplaceMatch *m = RECORD_MATCHES(rec);
+        for (size_t i = 0; i < count; i++)
+            memcpy(RECORD_OLD(rec, i), ROW_CHARS(&E.row[m[i].row]) + m[i].col, plen);
+    } else {
+        memcpy(RECORD_OLD(rec, 0), pattern, plen);
+    }
+    memcpy(RECORD_NEW(rec, 0), replacement, rlen);
+    ((char *) rec)[size - 1] = '\0';
+
+    replaceApply(rec);
+
+    Action act = {.length = (ssize_t) count, .ax = RECORD_MATCHES(rec)[0].col, .ay = RECORD_MATCHES(rec)[0].row,
+                  .type = REPLACE_TEXT, .data = (char *) rec, .sub = NULL};
+    H.push(&act);
+
+    return count;
+}
@@ -0,0 +1,340 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "search.h"
+
+#define SEARCH_BATCH 1024 /* rows scanned between two checks for cancellation */
+
+typedef struct {
+    int row, col, len;
+} SearchMatch;
+
+/*
+ * The pattern is compiled once per change and rows are scanned on a worker thread, starting at the
+ * cursor and wrapping around. Matches found in a batch are handed to the UI under `lock`, and a byte
+ * written to the wake pipe tells the UI thread to pick them up
+ */
+static struct {
+    int active; /* a find prompt is open */
+    int running, cancel, invalid;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    char *pattern;
+    regex_t regex;
+    int compiled;
+    int startrow, startcol;
+    int wake[2];
+
+    SearchMatch *matches; /* shared with the worker, guarded by lock */
+    int count, capacity;
+    int done;
+    int scanned, total; /* rows the worker went through, guarded by lock */
+
+    int current; /* index of the match the cursor is on, -1 if none yet */
+    SearchMatch cur;
+    int savedcx, savedcy, savedrowoff, savedcoloff;
+} F = {.wake = {-1, -1}, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void searchAppend(SearchMatch *batch, int n) {
+    pthread_mutex_lock(&F.lock);
+    if (F.count + n > F.capacity) {
+        F.capacity = (F.count + n) * 2;
+        F.matches = (SearchMatch *) allocResize(ALLOC_SEARCH, F.matches, sizeof(SearchMatch) * F.capacity);
+    }
+    memcpy(F.matches + F.count, batch, sizeof(SearchMatch) * n);
+    F.count += n;
+    pthread_mutex_unlock(&F.lock);
+}
+
+/*
+ * Description:
+ * Finds matches in row that start at a column in [from, to), appending them to batch
+ */
+static int searchRow(int at, int from, int to, SearchMatch **batch, int *n, int *capacity) {
+    const erow *row = &E.row[at];
+    const char *chars = ROW_CHARS(row);
+    regmatch_t m;
+    int col = from;
+
+    while (col <= (int) row->size && col < to) {
+        if (regexec(&F.regex, chars + col, 1, &m, col ? REG_NOTBOL : 0)) break;
+        int start = col + m.rm_so;
+        if (start >= to) break;
+
+        if (*n == *capacity) {
+            *capacity *= 2;
+            *batch = (SearchMatch *) allocResize(ALLOC_SEARCH, *batch, sizeof(SearchMatch) * *capacity);
+        }
+        (*batch)[(*n)++] = (SearchMatch) {at, start, m.rm_eo - m.rm_so};
+
+        col = m.rm_eo > m.rm_so ? col + m.rm_eo : start + 1;
+    }
+    return *n;
+}
+
+static int searchCancelled(void) {
+    pthread_mutex_lock(&F.lock);
+    int cancel = F.cancel;
+    pthread_mutex_unlock(&F.lock);
+    return cancel;
+}
+
+/*
+ * Description:
+ * Scans the start row from the cursor on, the rows after it, the rows before it and then the
+ * start of the start row, so matches arrive in the order they are visited from the cursor
+ */
+static void *searchWorker(void *arg) {
+    (void) arg;
+    int capacity = 64, n = 0;
+    SearchMatch *batch = (SearchMatch *) allocMem(ALLOC_SEARCH, sizeof(SearchMatch) * capacity);
+
+    editorRowsLock();
+    int numrows = E.numrows;
+    editorRowsUnlock();
+
+    pthread_mutex_lock(&F.lock);
+    F.total = numrows;
+    pthread_mutex_unlock(&F.lock);
+
+    for (int i = 0; i <= numrows; i += SEARCH_BATCH) {
+        if (searchCancelled()) break;
+
+        editorRowsLock();
+        /* rows appended meanwhile are left for the next scan, rows taken away end this one */
+        if (E.numrows < numrows) {
+            editorRowsUnlock();
+            break;
+        }
+        for (int k = i; k < i + SEARCH_BATCH && k <= numrows; k++) {
+            int at = (F.startrow + k) % numrows;
+            if (k == 0) searchRow(at, F.startcol, INT_MAX, &batch, &n, &capacity);
+            else if (k == numrows) searchRow(at, 0, F.startcol, &batch, &n, &capacity);
+            else searchRow(at, 0, INT_MAX, &batch, &n, &capacity);
+        }
+        editorRowsUnlock();
+
+        pthread_mutex_lock(&F.lock);
+        F.scanned = i + SEARCH_BATCH < numrows ? i + SEARCH_BATCH : numrows;
+        pthread_mutex_unlock(&F.lock);
+
+        if (n) {
+            searchAppend(batch, n);
+            n = 0;
+            if (write(F.wake[1], "", 1) == -1) {} /* the pipe being full already means a wakeup */
+        }
+    }
+    allocFree(batch);
+
+    pthread_mutex_lock(&F.lock);
+    F.done = 1;
+    pthread_mutex_unlock(&F.lock);
+    if (write(F.wake[1], "", 1) == -1) {}
+    return NULL;
+}
+
+static void searchStop(void) {
+    if (F.running) {
+        pthread_mutex_lock(&F.lock);
+        F.cancel = 1;
+        pthread_mutex_unlock(&F.lock);
+        pthread_join(F.worker, NULL);
+        F.running = 0;
+    }
+    if (F.compiled) {
+        regfree(&F.regex);
+        F.compiled = 0;
+    }
+
+    if (F.current >= 0) editorMarkDirty(F.cur.row, F.cur.row);
+    allocFree(F.matches);
+    F.matches = NULL;
+    F.count = F.capacity = 0;
+    F.current = -1;
+    F.done = 0;
+    F.cancel = 0;
+    F.invalid = 0;
+    F.scanned = F.total = 0;
+}
+
+static void searchMoveTo(int index) {
+    if (F.current >= 0) editorMarkDirty(F.cur.row, F.cur.row);
+
+    /* the worker may be growing the array meanwhile */
+    pthread_mutex_lock(&F.lock);
+    SearchMatch match = F.matches[index];
+    pthread_mutex_unlock(&F.lock);
+    /* found before rows were taken away from the end of the buffer */
+    if (match.row >= E.numrows) return;
+    F.cur = match;
+    F.current = index;
+
+    E.cy = F.cur.row;
+    E.cx = F.cur.col;
+    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    E.max_rx = E.rx;
+    editorMarkDirty(F.cur.row, F.cur.row);
+}
+
+/*
+ * Description:
+ * Cancels the running scan and starts a new one for pattern, from where the cursor was when find started
+ */
+static void searchStart(const char *pattern) {
+    searchStop();
+    E.cx = F.savedcx;
+    E.cy = F.savedcy;
+    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    if (!*pattern) return;
+
+    if (regcomp(&F.regex, pattern, REG_EXTENDED)) {
+        F.invalid = 1;
+        return;
+    }
+    F.compiled = 1;
+    F.startrow = F.savedcy;
+    F.startcol = F.savedcx;
+
+    if (pthread_create(&F.worker, NULL, searchWorker, NULL))
+        die("In function: %s\r\nAt line: %d\r\npthread_create", __func__, __LINE__);
+    F.running = 1;
+}
+
+static void searchCallback(const char *input, int key) {
+    if (!F.pattern || strcmp(F.pattern, input)) {
+        allocFree(F.pattern);
+        F.pattern = allocString(ALLOC_SEARCH, input);
+        searchStart(input);
+        return;
+    }
+
+    pthread_mutex_lock(&F.lock);
+    int count = F.count, done = F.done;
+    pthread_mutex_unlock(&F.lock);
+    if (!count) return;
+
+    if (key == ARROW_DOWN || key == ARROW_RIGHT) {
+        if (F.current + 1 < count) searchMoveTo(F.current + 1);
+        else if (done) searchMoveTo(0);
+    } else if (key == ARROW_UP || key == ARROW_LEFT) {
+        if (F.current > 0) searchMoveTo(F.current - 1);
+        else if (done) searchMoveTo(count - 1);
+    }
+}
+
+int searchActive(void) {
+    return F.active;
+}
+
+/* Waits for the worker to hand over matches while the find prompt is open */
+static int searchPending(int *fd, int *timeout) {
+    (void) timeout;
+    *fd = F.wake[0];
+    return F.active;
+}
+
+/*
+ * Description:
+ * Takes the matches the worker found since the last call, the first one moves the cursor
+ * The scan itself runs on the worker, it does not count against the budget
+ */
+static int searchCollect(long budget) {
+    (void) budget;
+    char buf[64];
+    while (read(F.wake[0], buf, sizeof(buf)) > 0)
+        ;
+
+    if (F.current < 0 && F.running) {
+        pthread_mutex_lock(&F.lock);
+        int count = F.count;
+        pthread_mutex_unlock(&F.lock);
+        if (count) searchMoveTo(0);
+    }
+    return 1;
+}
+
+static int searchProgress(void) {
+    pthread_mutex_lock(&F.lock);
+    int progress = F.total ? (int) ((long) F.scanned * 1000 / F.total) : -1;
+    pthread_mutex_unlock(&F.lock);
+    return progress;
+}
+
+const IdleTask searchTask = {"search", searchPending, searchCollect, searchProgress};
+
+/*
+ * Description:
+ * Returns 1 and the position of the match the cursor is on, if there is one
+ */
+int searchCurrent(int *row, int *col, int *len) {
+    if (!F.active || F.current < 0) return 0;
+    *row = F.cur.row;
+    *col = F.cur.col;
+    *len = F.cur.len;
+    return 1;
+}
+
+/*
+ * Description:
+ * Writes a short description of the search in progress to buf for the status bar
+ */
+int searchStatus(char *buf, int size) {
+    if (!F.active) return 0;
+    if (F.invalid) return snprintf(buf, size, " (invalid pattern)");
+    if (!F.running) return 0;
+
+    pthread_mutex_lock(&F.lock);
+    int count = F.count, done = F.done;
+    pthread_mutex_unlock(&F.lock);
+    return snprintf(buf, size, " (%s%d matches)", done ? "" : "searching, ", count);
+}
+
+/*
+ * Description:
+ * Searches for a regex (POSIX extended) as it is typed, arrow keys move between matches
+ * ENTER leaves the cursor on the match, ESC brings it back
+ */
+void editorFind(void) {
+    if (F.wake[0] == -1) {
+        if (pipe(F.wake) == -1) die("In function: %s\r\nAt line: %d\r\npipe", __func__, __LINE__);
+        fcntl(F.wake[0], F_SETFL, fcntl(F.wake[0], F_GETFL) | O_NONBLOCK);
+        fcntl(F.wake[1], F_SETFL, fcntl(F.wake[1], F_GETFL) | O_NONBLOCK);
+    }
+
+    F.savedcx = E.cx;
+    F.savedcy = E.cy;
+    F.savedrowoff = E.rowoff;
+    F.savedcoloff = E.coloff;
+    F.current = -1;
+    F.active = 1;
+
+    char *input = editorPrompt("Search (regex): ", S.maxMsgSize, searchCallback);
+    int found = F.current >= 0;
+
+    searchStop();
+    F.active = 0;
+    allocFree(F.pattern);
+    F.pattern = NULL;
+
+    if (!input || !found) {
+        E.cx = F.savedcx;
+        E.cy = F.savedcy;
+        E.rowoff = F.savedrowoff;
+        E.coloff = F.savedcoloff;
+    }
+    allocFree(input);
+    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    E.max_rx = E.rx;
+}
@@ -0,0 +1,718 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "types.h"
+#include "editor.h"
+#include "bracket.h"
+#include "history.h"
+#include "undotree.h"
+#include "replace.h"
+#include "session.h"
+
+#define SESSION_MAGIC "kilosnap" /* first 8 bytes of a snapshot, without the null character */
+#define SESSION_VERSION 1
+#define SESSION_SAMPLES 64       /* blocks of the file hashed to tell it did not change since the snapshot */
+#define SESSION_SAMPLE 4096
+#define SESSION_REFS (SIZE_MAX / 2) /* references of chars in a snapshot, rows never drop the last one */
+#define SESSION_NONE ((size_t) -1)
+#define SESSION_ALIGN(n) (((n) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/*
+ * A snapshot keeps the active buffer with its cursor, scroll offsets and undo tree, written on quit to
+ * $XDG_CACHE_HOME/kilo (or ~/.cache/kilo) under a hash of the file's path, and taken instead of parsing the
+ * file on the next start when the file still has the size, mtime and sampled hash it had
+ * It is the native layout of the records below, so only the build that wrote it reads it back: a header,
+ * then one section per record type, every section aligned to size_t
+ * Chars of every row are a block laid out like the ones ROW_SHARED rows point into, with a reference count
+ * no row ever drops, so rows of a mapped snapshot point right into it and are only copied once changed
+ * Chars shared by rows of the buffer, checkpoints and actions are stored once
+ */
+typedef struct {
+    size_t first, count; /* rows */
+} SessionList;
+
+typedef struct {
+    size_t chars; /* offset of the block in the chars section */
+    size_t size, rsize;
+    unsigned int osize;
+    unsigned short bclose, bopen;
+    unsigned char flags; /* ROW_TABS, ROW_DIRTY and ROW_BRACKETS */
+} SessionRow;
+
+typedef struct {
+    size_t parent, child, next, redo; /* nodes, SESSION_NONE for none, parents come before their children */
+    long seq;
+    time_t time;
+    size_t action;
+    size_t checkpoint; /* list of the rows of the checkpoint, SESSION_NONE for none */
+    int cx, cy;        /* of the checkpoint */
+} SessionNode;
+
+typedef struct {
+    ssize_t length;
+    int ax, ay;
+    int type;
+    /*
+     * REPLACE_ROWS: lists of the rows removed (data) and inserted (size)
+     * ACTION_GROUP: its length actions are stored from data on
+     * otherwise offset and size of the data in the data section, size is 0 when there is none
+     */
+    size_t data, size;
+} SessionAction;
+
+enum sessionSections {
+    SECTION_LISTS = 0,
+    SECTION_ROWS,
+    SECTION_NODES,
+    SECTION_ACTIONS,
+    SECTION_DATA,  /* bytes */
+    SECTION_CHARS, /* bytes */
+
+    SECTIONS,
+};
+
+static const size_t sessionRecord[SECTIONS] = {
+    sizeof(SessionList), sizeof(SessionRow), sizeof(SessionNode), sizeof(SessionAction), 1, 1,
+};
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned short records[5]; /* sizes of the header and records, a build laying them out differently fails */
+    size_t size;               /* of the whole snapshot */
+
+    /* file as of its last load/save */
+    off_t fsize;
+    struct timespec fmtime;
+    uint64_t hash;
+
+    size_t buffer; /* list of the rows of the buffer */
+    int cx, cy, rx, max_rx, rowoff, rowsub, coloff;
+    char eol[3];
+    int eolAtEof, firstmoved;
+
+    /* history, node 0 is the root */
+    size_t count, sinceCheckpoint, current;
+    long seq;
+
+    struct {
+        size_t offset, count;
+    } sections[SECTIONS];
+} SessionHeader;
+
+static uint64_t sessionFnv(uint64_t hash, const void *p, size_t len) {
+    const unsigned char *s = (const unsigned char *) p;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= s[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * Description:
+ * Hashes the size of the file and SESSION_SAMPLES blocks spread evenly over it, the first and last included,
+ * so telling a file did not change takes the same time whatever its size
+ * Returns -1 when the file can not be read
+ */
+static int sessionHash(int fd, off_t size, uint64_t *hash) {
+    char block[SESSION_SAMPLE];
+    off_t blocks = (size + SESSION_SAMPLE - 1) / SESSION_SAMPLE;
+    off_t samples = blocks < SESSION_SAMPLES ? blocks : SESSION_SAMPLES;
+
+    *hash = sessionFnv(FNV_OFFSET, &size, sizeof(size));
+    for (off_t i = 0; i < samples; i++) {
+        off_t at = (samples > 1 ? (blocks - 1) * i / (samples - 1) : 0) * SESSION_SAMPLE;
+        ssize_t n = pread(fd, block, sizeof(block), at);
+        if (n == -1) return -1;
+        *hash = sessionFnv(*hash, block, n);
+    }
+    return 0;
+}
+
+/*
+ * Description:
+ * Gets the path of the snapshot of filename, creating the directory it is in when create is set
+ * Returns -1 when there is no place for it
+ */
+static int sessionPath(const char *filename, char *path, size_t size, int create) {
+    char *real = realpath(filename, NULL);
+    if (!real) return -1;
+    uint64_t hash = sessionFnv(FNV_OFFSET, real, strlen(real));
+    free(real); /* from the C library */
+
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+    if (cache && *cache) len = snprintf(path, size, "%s", cache);
+    else if (home && *home) len = snprintf(path, size, "%s/.cache", home);
+    else return -1;
+    if (len < 0 || (size_t) len >= size) return -1;
+    if (create && mkdir(path, 0700) == -1 && errno != EEXIST) return -1;
+
+    len += snprintf(path + len, size - len, "/kilo");
+    if ((size_t) len >= size) return -1;
+    if (create && mkdir(path, 0700) == -1 && errno != EEXIST) return -1;
+
+    int total = snprintf(path + len, size - len, "/%016llx.session", (unsigned long long) hash);
+    return total < 0 || (size_t) total >= size - len ? -1 : 0;
+}
+
+/*** writing ***/
+
+/* Open addressing map from pointers to indices, to number nodes and store shared chars once */
+typedef struct {
+    const void **keys;
+    size_t *values;
+    size_t capacity, count;
+} SessionMap;
+
+static size_t sessionSlot(const SessionMap *map, const void *key) {
+    size_t i = (size_t) (((uint64_t) (uintptr_t) key >> 3) * 0x9e3779b97f4a7c15ULL) & (map->capacity - 1);
+    while (map->keys[i] && map->keys[i] != key) i = (i + 1) & (map->capacity - 1);
+    return i;
+}
+
+static size_t sessionMapGet(const SessionMap *map, const void *key) {
+    if (!key || !map->count) return SESSION_NONE;
+    size_t i = sessionSlot(map, key);
+    return map->keys[i] ? map->values[i] : SESSION_NONE;
+}
+
+static void sessionMapPut(SessionMap *map, const void *key, size_t value) {
+    if ((map->count + 1) * 2 > map->capacity) {
+        SessionMap old = *map;
+        map->capacity = old.capacity ? old.capacity * 2 : 64;
+        map->keys = (const void **) allocZero(ALLOC_IO, sizeof(void *) * map->capacity);
+        map->values = (size_t *) allocMem(ALLOC_IO, sizeof(size_t) * map->capacity);
+        for (size_t i = 0; i < old.capacity; i++) {
+            if (!old.keys[i]) continue;
+            size_t slot = sessionSlot(map, old.keys[i]);
+            map->keys[slot] = old.keys[i];
+            map->values[slot] = old.values[i];
+        }
+        allocFree(old.keys);
+        allocFree(old.values);
+    }
+    size_t i = sessionSlot(map, key);
+    if (!map->keys[i]) map->count++;
+    map->keys[i] = key;
+    map->values[i] = value;
+}
+
+/* Records of a snapshot being taken, chars are only written out at the end, from the rows in blocks */
+typedef struct {
+    void *items[SECTIONS];
+    size_t count[SECTIONS], capacity[SECTIONS];
+    const erow **blocks;
+    size_t nblocks, cblocks;
+    SessionMap shared; /* chars of ROW_SHARED rows to their offset */
+    SessionMap nodes;  /* nodes to their index */
+} SessionOut;
+
+#define OUT_RECORDS(out, type, section) ((type *) (out)->items[section])
+
+/* Returns the index of the first of n records added to section */
+static size_t sessionReserve(SessionOut *out, int section, size_t n) {
+    size_t first = out->count[section];
+    if (first + n > out->capacity[section]) {
+        size_t capacity = out->capacity[section] ? out->capacity[section] : 64;
+        while (capacity < first + n) capacity *= 2;
+        out->items[section] = allocResize(ALLOC_IO, out->items[section], capacity * sessionRecord[section]);
+        out->capacity[section] = capacity;
+    }
+    out->count[section] += n;
+    return first;
+}
+
+static size_t sessionChars(SessionOut *out, const erow *row) {
+    size_t offset = out->count[SECTION_CHARS];
+    if (row->flags & ROW_SHARED) {
+        size_t known = sessionMapGet(&out->shared, row->data.heap);
+        if (known != SESSION_NONE) return known;
+        sessionMapPut(&out->shared, row->data.heap, offset);
+    }
+    if (out->nblocks == out->cblocks) {
+        out->cblocks = out->cblocks ? out->cblocks * 2 : 256;
+        out->blocks = (const erow **) allocResize(ALLOC_IO, out->blocks, sizeof(erow *) * out->cblocks);
+    }
+    out->blocks[out->nblocks++] = row;
+    out->count[SECTION_CHARS] += ROW_SHARED_BYTES(row->size);
+    return offset;
+}
+
+/* Returns the index of the list */
+static size_t sessionList(SessionOut *out, const erow *rows, int count) {
+    size_t first = sessionReserve(out, SECTION_ROWS, count);
+    for (int i = 0; i < count; i++) {
+        const erow *row = &rows[i];
+        SessionRow rec = {sessionChars(out, row), row->size, row->rsize, row->osize, row->bclose, row->bopen,
+                          row->flags & (ROW_TABS | ROW_DIRTY | ROW_BRACKETS)};
+        OUT_RECORDS(out, SessionRow, SECTION_ROWS)[first + i] = rec;
+    }
+    size_t list = sessionReserve(out, SECTION_LISTS, 1);
+    OUT_RECORDS(out, SessionList, SECTION_LISTS)[list] = (SessionList) {first, count};
+    return list;
+}
+
+static size_t sessionData(SessionOut *out, const char *data, size_t size) {
+    size_t offset = sessionReserve(out, SECTION_DATA, size);
+    memcpy(OUT_RECORDS(out, char, SECTION_DATA) + offset, data, size);
+    return offset;
+}
+
+static void sessionActionOut(SessionOut *out, size_t i, const Action *act) {
+    SessionAction rec = {act->length, act->ax, act->ay, act->type, 0, 0};
+    switch (act->type) {
+        case REPLACE_TEXT:
+            rec.size = replaceSize(act);
+            rec.data = sessionData(out, act->data, rec.size);
+            break;
+        case REPLACE_ROWS: {
+            const erowReplace *rep = (const erowReplace *) act->data;
+            rec.data = sessionList(out, rep->removed->rows, rep->removed->count);
+            rec.size = sessionList(out, rep->inserted->rows, rep->inserted->count);
+            break;
+        }
+        case ACTION_GROUP:
+            /* children are stored next to each other, their own children after them */
+            rec.data = sessionReserve(out, SECTION_ACTIONS, act->length);
+            for (ssize_t k = 0; k < act->length; k++)
+                sessionActionOut(out, rec.data + k, &act->sub[k]);
+            break;
+        default:
+            if (act->data) {
+                rec.size = strlen(act->data) + 1;
+                rec.data = sessionData(out, act->data, rec.size);
+            }
+            break;
+    }
+    OUT_RECORDS(out, SessionAction, SECTION_ACTIONS)[i] = rec;
+}
+
+static size_t sessionNodeIndex(const SessionOut *out, const UndoNode *node) {
+    return node ? sessionMapGet(&out->nodes, node) : SESSION_NONE;
+}
+
+static void sessionNodesOut(SessionOut *out) {
+    size_t n = 0;
+    for (UndoNode *node = H.root; node; node = treeNext(node, H.root))
+        sessionMapPut(&out->nodes, node, n++);
+    sessionReserve(out, SECTION_NODES, n);
+
+    n = 0;
+    for (UndoNode *node = H.root; node; node = treeNext(node, H.root)) {
+        SessionNode rec = {
+            sessionNodeIndex(out, node->parent), sessionNodeIndex(out, node->child),
+            sessionNodeIndex(out, node->next), sessionNodeIndex(out, node->redo),
+            node->seq, node->time, 0, SESSION_NONE, 0, 0,
+        };
+        rec.action = sessionReserve(out, SECTION_ACTIONS, 1);
+        sessionActionOut(out, rec.action, &node->action);
+        if (node->checkpoint) {
+            rec.checkpoint = sessionList(out, node->checkpoint->rows->rows, node->checkpoint->rows->count);
+            rec.cx = node->checkpoint->cx;
+            rec.cy = node->checkpoint->cy;
+        }
+        OUT_RECORDS(out, SessionNode, SECTION_NODES)[n++] = rec;
+    }
+}
+
+static int sessionPad(FILE *fp, size_t n) {
+    static const char zeros[sizeof(size_t)];
+    return fwrite(zeros, 1, n, fp) == n ? 0 : -1;
+}
+
+static int sessionWrite(FILE *fp, SessionOut *out, SessionHeader *hdr) {
+    size_t at = SESSION_ALIGN(sizeof(SessionHeader));
+    for (int s = 0; s < SECTIONS; s++) {
+        hdr->sections[s].offset = at;
+        hdr->sections[s].count = out->count[s];
+        at = SESSION_ALIGN(at + out->count[s] * sessionRecord[s]);
+    }
+    hdr->size = at;
+
+    if (fwrite(hdr, sizeof(SessionHeader), 1, fp) != 1) return -1;
+    if (sessionPad(fp, SESSION_ALIGN(sizeof(SessionHeader)) - sizeof(SessionHeader)) == -1) return -1;
+    for (int s = 0; s < SECTION_CHARS; s++) {
+        size_t bytes = out->count[s] * sessionRecord[s];
+        if (bytes && fwrite(out->items[s], bytes, 1, fp) != 1) return -1;
+        if (sessionPad(fp, SESSION_ALIGN(bytes) - bytes) == -1) return -1;
+    }
+
+    size_t refs = SESSION_REFS;
+    for (size_t i = 0; i < out->nblocks; i++) {
+        const erow *row = out->blocks[i];
+        if (row->size && fwrite(ROW_CHARS(row), row->size, 1, fp) != 1) return -1;
+        if (sessionPad(fp, ROW_SHARED_BYTES(row->size) - sizeof(size_t) - row->size) == -1) return -1;
+        if (fwrite(&refs, sizeof(refs), 1, fp) != 1) return -1;
+    }
+    return 0;
+}
+
+static void sessionOutFree(SessionOut *out) {
+    for (int s = 0; s < SECTIONS; s++) allocFree(out->items[s]);
+    allocFree(out->blocks);
+    allocFree(out->shared.keys);
+    allocFree(out->shared.values);
+    allocFree(out->nodes.keys);
+    allocFree(out->nodes.values);
+}
+
+/*
+ * Description:
+ * Writes a snapshot of the active buffer, when its file on disk is the one its rows were loaded from or saved to
+ * It is written next to the old one and moved over it, so a mapped old snapshot stays intact
+ * Snapshots that can not be written are skipped, quitting is never held up by them
+ */
+void sessionSave(void) {
+    if (!E.filename || H.grouping) return;
+    H.commit();
+
+    int fd = open(E.filename, O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    SessionHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    int same = fstat(fd, &st) != -1 && st.st_size == E.fsize && st.st_mtim.tv_sec == E.fmtime.tv_sec &&
+               st.st_mtim.tv_nsec == E.fmtime.tv_nsec && sessionHash(fd, st.st_size, &hdr.hash) != -1;
+    close(fd);
+    if (!same) return;
+
+    char path[PATH_MAX], tmp[PATH_MAX + 8];
+    if (sessionPath(E.filename, path, sizeof(path), 1) == -1) return;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    memcpy(hdr.magic, SESSION_MAGIC, sizeof(hdr.magic));
+    hdr.version = SESSION_VERSION;
+    hdr.records[0] = sizeof(SessionHeader);
+    hdr.records[1] = sizeof(SessionList);
+    hdr.records[2] = sizeof(SessionRow);
+    hdr.records[3] = sizeof(SessionNode);
+    hdr.records[4] = sizeof(SessionAction);
+    hdr.fsize = E.fsize;
+    hdr.fmtime = E.fmtime;
+
+    hdr.cx = E.cx;
+    hdr.cy = E.cy;
+    hdr.rx = E.rx;
+    hdr.max_rx = E.max_rx;
+    hdr.rowoff = E.rowoff;
+    hdr.rowsub = E.rowsub;
+    hdr.coloff = E.coloff;
+    memcpy(hdr.eol, E.eol, sizeof(hdr.eol));
+    hdr.eolAtEof = E.eolAtEof;
+    hdr.firstmoved = E.firstmoved;
+
+    hdr.count = H.count;
+    hdr.sinceCheckpoint = H.sinceCheckpoint;
+    hdr.seq = H.seq;
+
+    SessionOut out;
+    memset(&out, 0, sizeof(out));
+    hdr.buffer = sessionList(&out, E.row, E.numrows);
+    sessionNodesOut(&out);
+    hdr.current = sessionNodeIndex(&out, H.current);
+
+    FILE *fp = fopen(tmp, "w");
+    int failed = !fp || sessionWrite(fp, &out, &hdr) == -1;
+    if (fp && fclose(fp) == EOF) failed = 1;
+    if (failed || rename(tmp, path) == -1) unlink(tmp);
+    sessionOutFree(&out);
+}
+
+/*** loading ***/
+
+typedef struct {
+    char *base;
+    const SessionHeader *hdr;
+} SessionIn;
+
+#define IN_RECORDS(in, type, section) ((type *) ((in)->base + (in)->hdr->sections[section].offset))
+#define IN_COUNT(in, section) ((in)->hdr->sections[section].count)
+
+static int sessionValidList(const SessionIn *in, size_t list) {
+    if (list >= IN_COUNT(in, SECTION_LISTS)) return 0;
+    const SessionList *l = &IN_RECORDS(in, SessionList, SECTION_LISTS)[list];
+    return l->first <= IN_COUNT(in, SECTION_ROWS) && l->count <= IN_COUNT(in, SECTION_ROWS) - l->first &&
+           l->count <= INT_MAX;
+}
+
+/* Bytes in a section are checked before anything is built, so building never fails half way */
+/* cy is a row of the list, or the one past its end, and cx a position in that row */
+static int sessionValidCursor(const SessionIn *in, size_t list, int cx, int cy) {
+    const SessionList *l = &IN_RECORDS(in, SessionList, SECTION_LISTS)[list];
+    const SessionRow *rows = IN_RECORDS(in, SessionRow, SECTION_ROWS);
+    return cy >= 0 && (size_t) cy <= l->count && cx >= 0 &&
+           ((size_t) cy == l->count || (size_t) cx <= rows[l->first + cy].size);
+}
+static int sessionValid(const SessionIn *in, size_t size) {
+    const SessionHeader *hdr = in->hdr;
+    if (memcmp(hdr->magic, SESSION_MAGIC, sizeof(hdr->magic)) || hdr->version != SESSION_VERSION ||
+        hdr->records[0] != sizeof(SessionHeader) || hdr->records[1] != sizeof(SessionList) ||
+        hdr->records[2] != sizeof(SessionRow) || hdr->records[3] != sizeof(SessionNode) ||
+        hdr->records[4] != sizeof(SessionAction) || hdr->size != size)
+        return 0;
+    for (int s = 0; s < SECTIONS; s++) {
+        size_t offset = hdr->sections[s].offset;
+        if (offset % sizeof(size_t) || offset > size ||
+            hdr->sections[s].count > (size - offset) / sessionRecord[s])
+            return 0;
+    }
+
+    const char *chars = IN_RECORDS(in, char, SECTION_CHARS);
+    const SessionRow *rows = IN_RECORDS(in, SessionRow, SECTION_ROWS);
+    for (size_t i = 0; i < IN_COUNT(in, SECTION_ROWS); i++) {
+        size_t nchars = IN_COUNT(in, SECTION_CHARS);
+        if (rows[i].chars % sizeof(size_t) || rows[i].size >= nchars || ROW_SHARED_BYTES(rows[i].size) > nchars ||
+            rows[i].chars > nchars - ROW_SHARED_BYTES(rows[i].size) || chars[rows[i].chars + rows[i].size])
+            return 0;
+    }
+    for (size_t i = 0; i < IN_COUNT(in, SECTION_LISTS); i++) {
+        if (!sessionValidList(in, i)) return 0;
+    }
+
+    const char *data = IN_RECORDS(in, char, SECTION_DATA);
+    const SessionAction *actions = IN_RECORDS(in, SessionAction, SECTION_ACTIONS);
+    size_t nactions = IN_COUNT(in, SECTION_ACTIONS), ndata = IN_COUNT(in, SECTION_DATA);
+    /* no state of the buffer has more rows than all stored ones plus a row per action, nor longer rows than all text */
+    size_t maxrows = IN_COUNT(in, SECTION_ROWS) + nactions;
+    size_t maxcols = IN_COUNT(in, SECTION_CHARS) + ndata;
+    for (size_t i = 0; i < nactions; i++) {
+        const SessionAction *act = &actions[i];
+        if (act->ay < 0 || (size_t) act->ay > maxrows || act->ax < 0 || (size_t) act->ax > maxcols) return 0;
+        switch (act->type) {
+            case REPLACE_ROWS:
+                if (!sessionValidList(in, act->data) || !sessionValidList(in, act->size)) return 0;
+                break;
+            case ACTION_GROUP:
+                /* children come after their group, so groups never nest in a loop */
+                if (act->length < 0 || act->data <= i || act->data > nactions ||
+                    (size_t) act->length > nactions - act->data)
+                    return 0;
+                break;
+            default:
+                if (act->type < INSERT_CHAR_BEF || act->type > REPLACE_TEXT) return 0;
+                if (act->size && (act->data > ndata || act->size > ndata - act->data ||
+                                  data[act->data + act->size - 1]))
+                    return 0;
+                if (act->type == REPLACE_TEXT && !replaceValid(data + act->data, act->size, maxrows, maxcols)) return 0;
+                break;
+        }
+    }
+
+    /* links are checked against parents, and point forward, so the nodes form a tree */
+    const SessionNode *nodes = IN_RECORDS(in, SessionNode, SECTION_NODES);
+    size_t nnodes = IN_COUNT(in, SECTION_NODES);
+    if (!nnodes || nodes[0].parent != SESSION_NONE || hdr->current >= nnodes) return 0;
+    for (size_t i = 0; i < nnodes; i++) {
+        const SessionNode *node = &nodes[i];
+        if (i && node->parent >= i) return 0;
+        if (node->child != SESSION_NONE && (node->child <= i || node->child >= nnodes || nodes[node->child].parent != i))
+            return 0;
+        if (node->redo != SESSION_NONE && (node->redo <= i || node->redo >= nnodes || nodes[node->redo].parent != i))
+            return 0;
+        if (node->next != SESSION_NONE &&
+            (node->next <= i || node->next >= nnodes || nodes[node->next].parent != node->parent))
+            return 0;
+        if (node->action >= nactions) return 0;
+        if (node->checkpoint != SESSION_NONE &&
+            (!sessionValidList(in, node->checkpoint) || !sessionValidCursor(in, node->checkpoint, node->cx, node->cy)))
+            return 0;
+    }
+
+    if (!sessionValidList(in, hdr->buffer)) return 0;
+    const SessionList *buffer = &IN_RECORDS(in, SessionList, SECTION_LISTS)[hdr->buffer];
+    if (!buffer->count || !sessionValidCursor(in, hdr->buffer, hdr->cx, hdr->cy) || hdr->rowoff < 0 ||
+        (size_t) hdr->rowoff > buffer->count || hdr->rowsub < 0 || hdr->coloff < 0 || !memchr(hdr->eol, '\0', sizeof(hdr->eol)))
+        return 0;
+    return 1;
+}
+
+/* Rows of at least ROW_INLINE_SIZE chars point into the snapshot */
+/* rsize and ROW_TABS are worked out again from the chars, the render buffer is built from them */
+static void sessionRow(const SessionIn *in, const SessionRow *rec, erow *row) {
+    char *chars = IN_RECORDS(in, char, SECTION_CHARS) + rec->chars;
+    int tabs;
+    row->size = rec->size;
+    row->rsize = editorRenderSize(chars, rec->size, &tabs);
+    row->render = NULL;
+    row->wraps = NULL;
+    row->osize = rec->osize;
+    row->bclose = rec->bclose;
+    row->bopen = rec->bopen;
+    row->flags = (rec->flags & (ROW_DIRTY | ROW_BRACKETS)) | (tabs ? ROW_TABS : 0);
+    if (rec->size < ROW_INLINE_SIZE) {
+        memcpy(row->data.buf, chars, rec->size + 1);
+        row->flags |= ROW_INLINE;
+    } else {
+        row->data.heap = chars;
+        row->flags |= ROW_SHARED;
+    }
+}
+
+static erowList *sessionRows(const SessionIn *in, size_t list) {
+    const SessionList *l = &IN_RECORDS(in, SessionList, SECTION_LISTS)[list];
+    erowList *rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * l->count);
+    rows->count = l->count;
+    for (size_t i = 0; i < l->count; i++)
+        sessionRow(in, &IN_RECORDS(in, SessionRow, SECTION_ROWS)[l->first + i], &rows->rows[i]);
+    return rows;
+}
+
+static void sessionActionIn(const SessionIn *in, size_t i, Action *act) {
+    const SessionAction *rec = &IN_RECORDS(in, SessionAction, SECTION_ACTIONS)[i];
+    *act = (Action) {rec->length, rec->ax, rec->ay, (ActionType) rec->type, NULL, NULL};
+    switch (rec->type) {
+        case REPLACE_ROWS: {
+            erowReplace *rep = (erowReplace *) allocMem(ALLOC_HISTORY, sizeof(erowReplace));
+            rep->removed = sessionRows(in, rec->data);
+            rep->inserted = sessionRows(in, rec->size);
+            act->data = (char *) rep;
+            break;
+        }
+        case ACTION_GROUP: {
+            /* room up to the next power of two, as actionGroupAppend() expects */
+            ssize_t capacity = 1;
+            while (capacity < rec->length) capacity *= 2;
+            if (rec->length) act->sub = (Action *) allocMem(ALLOC_HISTORY, sizeof(Action) * capacity);
+            for (ssize_t k = 0; k < rec->length; k++)
+                sessionActionIn(in, rec->data + k, &act->sub[k]);
+            break;
+        }
+        default: {
+            if (!rec->size) break;
+            /* edits of single chars are replayed for length bytes, even past a null character */
+            size_t size = rec->size;
+            size_t length = (size_t) (rec->length < 0 ? -rec->length : rec->length);
+            if (rec->type != REPLACE_TEXT && length + 1 > size) size = length + 1;
+            act->data = (char *) allocZero(ALLOC_HISTORY, size);
+            memcpy(act->data, IN_RECORDS(in, char, SECTION_DATA) + rec->data, rec->size);
+            break;
+        }
+    }
+}
+
+static void sessionHistoryIn(const SessionIn *in) {
+    const SessionNode *recs = IN_RECORDS(in, SessionNode, SECTION_NODES);
+    size_t n = IN_COUNT(in, SECTION_NODES);
+    UndoNode **nodes = (UndoNode **) allocMem(ALLOC_IO, sizeof(UndoNode *) * n);
+    for (size_t i = 0; i < n; i++)
+        nodes[i] = (UndoNode *) allocZero(ALLOC_HISTORY, sizeof(UndoNode));
+
+    for (size_t i = 0; i < n; i++) {
+        const SessionNode *rec = &recs[i];
+        UndoNode *node = nodes[i];
+        node->parent = rec->parent != SESSION_NONE ? nodes[rec->parent] : NULL;
+        node->child = rec->child != SESSION_NONE ? nodes[rec->child] : NULL;
+        node->next = rec->next != SESSION_NONE ? nodes[rec->next] : NULL;
+        node->redo = rec->redo != SESSION_NONE ? nodes[rec->redo] : NULL;
+        node->depth = node->parent ? node->parent->depth + 1 : 0;
+        node->seq = rec->seq;
+        node->time = rec->time;
+        sessionActionIn(in, rec->action, &node->action);
+        if (rec->checkpoint != SESSION_NONE) {
+            node->checkpoint = (Checkpoint *) allocMem(ALLOC_HISTORY, sizeof(Checkpoint));
+            node->checkpoint->rows = sessionRows(in, rec->checkpoint);
+            node->checkpoint->cx = rec->cx;
+            node->checkpoint->cy = rec->cy;
+        }
+    }
+
+    H.delete();
+    H.root = nodes[0];
+    H.current = nodes[in->hdr->current];
+    H.count = in->hdr->count;
+    H.seq = in->hdr->seq;
+    H.sinceCheckpoint = in->hdr->sinceCheckpoint;
+    H.time = time(NULL);
+    allocFree(nodes);
+}
+
+/*
+ * Description:
+ * Restores the buffer, cursor and history of filename from its snapshot, in place of editorOpen() at start
+ * The snapshot stays mapped for as long as the editor runs, rows point into it
+ * Returns 0 when there is no snapshot, or it is not of the file as it is on disk now
+ */
+int sessionLoad(const char *filename) {
+    char path[PATH_MAX];
+    if (sessionPath(filename, path, sizeof(path), 0) == -1) return 0;
+
+    /* most files have no snapshot, they are not read for the hash */
+    int sfd = open(path, O_RDONLY);
+    if (sfd == -1) return 0;
+    struct stat sst;
+    if (fstat(sfd, &sst) == -1 || (size_t) sst.st_size < sizeof(SessionHeader)) {
+        close(sfd);
+        return 0;
+    }
+
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    SessionHeader hdr;
+    int ok = fd != -1 && fstat(fd, &st) != -1 && sessionHash(fd, st.st_size, &hdr.hash) != -1;
+    if (fd != -1) close(fd);
+    if (!ok) {
+        close(sfd);
+        return 0;
+    }
+    uint64_t hash = hdr.hash;
+
+    /* private and writable: reference counts of the rows pointing in are changed in the editor's copy only */
+    char *base = (char *) mmap(NULL, sst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, sfd, 0);
+    close(sfd);
+    if (base == MAP_FAILED) return 0;
+
+    SessionIn in = {base, (const SessionHeader *) base};
+    if (!sessionValid(&in, sst.st_size) || in.hdr->fsize != st.st_size || in.hdr->hash != hash ||
+        in.hdr->fmtime.tv_sec != st.st_mtim.tv_sec || in.hdr->fmtime.tv_nsec != st.st_mtim.tv_nsec) {
+        munmap(base, sst.st_size);
+        return 0;
+    }
+
+    const SessionHeader *h = in.hdr;
+    const SessionList *buffer = &IN_RECORDS(&in, SessionList, SECTION_LISTS)[h->buffer];
+    E.numrows = buffer->count;
+    E.row = (erow *) allocMem(ALLOC_ROWS, sizeof(erow) * E.numrows);
+    for (int i = 0; i < E.numrows; i++)
+        sessionRow(&in, &IN_RECORDS(&in, SessionRow, SECTION_ROWS)[buffer->first + i], &E.row[i]);
+    bracketInvalidate(0);
+
+    allocFree(E.filename);
+    E.filename = allocString(ALLOC_IO, filename);
+    memcpy(E.eol, h->eol, sizeof(E.eol));
+    E.eolAtEof = h->eolAtEof;
+    E.firstmoved = h->firstmoved;
+    E.fsize = h->fsize;
+    E.fmtime = h->fmtime;
+
+    E.cx = h->cx;
+    E.cy = h->cy;
+    E.rx = h->rx;
+    E.max_rx = h->max_rx;
+    E.rowoff = h->rowoff;
+    E.rowsub = h->rowsub;
+    E.coloff = h->coloff;
+
+    sessionHistoryIn(&in);
+    return 1;
+}
@@ -0,0 +1,401 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "history.h"
+#include "idle.h"
+#include "intern.h"
+#include "undotree.h"
+#include "window.h"
+#include "stream.h"
+
+#define STREAM_CHUNK (64 << 10) /* read at a time, small enough to be split into rows within an idle slice */
+#define FOLLOW_POLL_MS 250 /* how often a followed file is checked for growth */
+
+/*
+ * Rows are appended to the buffer as data arrives
+ * The last row of the buffer is the line currently being received
+ * A followed file is read the same way, from the offset where the buffer ends in the file
+ */
+static struct {
+    int fd;
+    size_t loaded;
+    off_t total; /* size of stdin when it is a regular file, 0 when it is not known */
+    int sawEol;
+    char *buf;
+
+    int follow;   /* the followed file, -1 when not following */
+    dev_t dev;
+    ino_t ino;
+    off_t offset; /* bytes of the followed file already in the buffer */
+    off_t target; /* size of the followed file when the last step started */
+    int behind;   /* the last step ran out of time before reaching the end of the file */
+} T = {.fd = -1, .follow = -1};
+
+/*
+ * Description:
+ * Keeps the piped stdin for loading and puts the terminal in its place so keys can be read
+ */
+void streamOpenStdin(void) {
+    T.fd = dup(STDIN_FILENO);
+    if (T.fd == -1) die("In function: %s\r\nAt line: %d\r\ndup", __func__, __LINE__);
+
+    int tty = open("/dev/tty", O_RDWR);
+    if (tty == -1) die("In function: %s\r\nAt line: %d\r\nopen /dev/tty", __func__, __LINE__);
+    if (dup2(tty, STDIN_FILENO) == -1) die("In function: %s\r\nAt line: %d\r\ndup2", __func__, __LINE__);
+    close(tty);
+
+    fcntl(T.fd, F_SETFL, fcntl(T.fd, F_GETFL) | O_NONBLOCK);
+    T.buf = (char *) allocMem(ALLOC_IO, STREAM_CHUNK);
+
+    struct stat st;
+    if (fstat(T.fd, &st) == 0 && S_ISREG(st.st_mode)) T.total = st.st_size;
+}
+
+int streamPending(void) {
+    return T.fd != -1;
+}
+
+size_t streamLoaded(void) {
+    return T.loaded;
+}
+
+static void streamAppendToLast(const char *s, size_t len) {
+    if (!len) return;
+    erow *row = &E.row[E.numrows - 1];
+    char *chars = editorRowReserve(row, row->size + len);
+    memcpy(chars + row->size, s, len);
+    row->size += len;
+    chars[row->size] = '\0';
+    editorUpdateRow(row);
+}
+
+static void streamEndLine(void) {
+    erow *row = &E.row[E.numrows - 1];
+    if (!T.sawEol) {
+        strcpy(E.eol, row->size && ROW_CHARS(row)[row->size - 1] == '\r' ? "\r\n" : "\n");
+        T.sawEol = 1;
+    }
+    if (row->size && ROW_CHARS(row)[row->size - 1] == '\r') {
+        char *chars = editorRowWritable(row); /* finds a shared block by the size it still has */
+        chars[--row->size] = '\0';
+        editorRowReserve(row, row->size);
+        editorUpdateRow(row);
+    }
+}
+
+/*
+ * Description:
+ * Splits a chunk into rows, all the complete lines of the chunk are appended in one go
+ */
+static void streamConsume(const char *buf, size_t len) {
+    const char *end = buf + len;
+    const char *nl = memchr(buf, '\n', len);
+    if (!nl) {
+        streamAppendToLast(buf, len);
+        return;
+    }
+    streamAppendToLast(buf, nl - buf);
+    streamEndLine();
+
+    int count = 1;
+    for (const char *p = nl + 1; (p = memchr(p, '\n', end - p)); p++)
+        count++;
+
+    erowList *rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow) * count);
+    rows->count = count;
+
+    const char *line = nl + 1;
+    for (int i = 0; i < count; i++) {
+        const char *next = i < count - 1 ? memchr(line, '\n', end - line) : end;
+        size_t linelen = next - line;
+        if (i < count - 1 && linelen && line[linelen - 1] == '\r') linelen--;
+        internRow(&rows->rows[i], line, linelen);
+        line = next + 1;
+    }
+    editorRowsFree(editorRowsReplace(E.numrows, 0, rows));
+}
+
+static void streamClose(void) {
+    close(T.fd);
+    T.fd = -1;
+    allocFree(T.buf);
+    T.buf = NULL;
+
+    /* Like a file, a trailing newline does not make an extra empty row */
+    E.eolAtEof = 0;
+    if (E.numrows > 1 && !E.row[E.numrows - 1].size) {
+        erowList *with = (erowList *) allocZero(ALLOC_ROWS, sizeof(erowList));
+        editorRowsFree(editorRowsReplace(E.numrows - 1, 1, with));
+        E.eolAtEof = 1;
+        if (E.cy >= E.numrows) {
+            E.cy = E.numrows - 1;
+            E.cx = 0;
+        }
+    }
+}
+
+static long streamElapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+/* Waits for data on the pipe while something is being loaded */
+static int streamPendingIdle(int *fd, int *timeout) {
+    (void) timeout;
+    *fd = T.fd;
+    return T.fd != -1;
+}
+
+/*
+ * Description:
+ * Reads what is available on the pipe for budget nanoseconds and appends it to the buffer
+ * Returns early when the pipe has no data, so waiting is left to the scheduler
+ */
+static int streamStep(long budget) {
+    if (T.fd == -1) return 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        ssize_t n = read(T.fd, T.buf, STREAM_CHUNK);
+        if (n > 0) {
+            T.loaded += n;
+            editorRowsLock();
+            streamConsume(T.buf, n);
+            editorRowsUnlock();
+        } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            editorRowsLock();
+            streamClose();
+            editorRowsUnlock();
+            return 1;
+        } else if (errno == EAGAIN) {
+            break;
+        }
+    } while (streamElapsed(&start) < budget);
+    return 1;
+}
+
+static int streamProgress(void) {
+    if (!T.total) return -1;
+    return T.loaded >= (size_t) T.total ? 1000 : (int) (T.loaded * 1000 / T.total);
+}
+
+const IdleTask streamTask = {"stdin", streamPendingIdle, streamStep, streamProgress};
+
+/*** follow ***/
+/*
+ * Description:
+ * Starts appending what is written to E.filename to the buffer
+ * Returns 0 when the file can not be opened
+ */
+int followStart(void) {
+    if (T.follow != -1) return 1;
+    if (!E.filename) return 0;
+
+    T.follow = open(E.filename, O_RDONLY);
+    if (T.follow == -1) return 0;
+
+    struct stat st;
+    if (fstat(T.follow, &st) == -1) die("In function: %s\r\nAt line: %d\r\nfstat", __func__, __LINE__);
+    T.dev = st.st_dev;
+    T.ino = st.st_ino;
+    /* what was written since the file was loaded or saved is picked up by the first step */
+    T.offset = E.fsize <= st.st_size ? E.fsize : st.st_size;
+    T.behind = 1;
+    /* the line ending of the file is kept once it has been seen */
+    T.sawEol = E.eolAtEof || E.numrows > 1;
+    if (!T.buf) T.buf = (char *) allocMem(ALLOC_IO, STREAM_CHUNK);
+    return 1;
+}
+
+void followStop(void) {
+    if (T.follow == -1) return;
+    close(T.follow);
+    T.follow = -1;
+    allocFree(T.buf);
+    T.buf = NULL;
+}
+
+int followActive(void) {
+    return T.follow != -1;
+}
+
+
+/*
+ * Description:
+ * Loads the file again after it was truncated or replaced
+ * Unsaved changes are not thrown away, following stops instead
+ */
+static void followReopen(void) {
+    int modified = E.firstmoved != INT_MAX;
+    for (int i = 0; i < E.numrows && !modified; i++)
+        modified = E.row[i].flags & ROW_DIRTY;
+    if (modified) {
+        followStop();
+        editorSetMessage("%s was truncated or replaced, follow stopped to keep unsaved changes", E.filename);
+        return;
+    }
+
+    char *filename = E.filename;
+    editorRowsLock();
+    for (int i = 0; i < E.numrows; i++)
+        editorRowFree(&E.row[i]);
+    allocFree(E.row);
+    E.row = NULL;
+    E.numrows = 0;
+    E.filename = NULL;
+    editorOpen(filename);
+    editorRowsUnlock();
+    allocFree(filename);
+
+    H.delete();
+    historyInit();
+
+    E.cy = E.numrows - 1;
+    E.cx = E.rx = E.max_rx = 0;
+    E.rowoff = E.rowsub = E.coloff = 0;
+    windowLayout();
+
+    followStop();
+    if (!followStart()) editorSetMessage("Can not follow %s", E.filename);
+}
+
+/*
+ * Description:
+ * Appends the bytes from the followed file past offset, up to size, for budget nanoseconds
+ * Rows that were the same as the file stay that way, so saving still writes in place
+ */
+static void followAppend(off_t size, const struct timespec *mtime, long budget) {
+    int synced = E.firstmoved == INT_MAX && E.fsize == T.offset;
+    int pinned = E.cy == E.numrows - 1;
+    int first = E.numrows - 1;
+    size_t firstsize = E.row[first].size;
+    int firstdirty = E.row[first].flags & ROW_DIRTY;
+
+    /* appended rows are not in the history, checkpoints taken before would bring back the old end */
+    H.commit();
+    treeDropCheckpoints(H.root);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    editorRowsLock();
+    if (E.eolAtEof) {
+        /* the file ended with a newline, what comes next starts a new row */
+        erowList *rows = (erowList *) allocMem(ALLOC_ROWS, sizeof(erowList) + sizeof(erow));
+        rows->count = 1;
+        editorRowSet(&rows->rows[0], "", 0);
+        editorRowsFree(editorRowsReplace(E.numrows, 0, rows));
+        first++;
+        firstsize = 0;
+        firstdirty = 0;
+    }
+    do {
+        size_t want = size - T.offset < STREAM_CHUNK ? (size_t) (size - T.offset) : STREAM_CHUNK;
+        ssize_t n = pread(T.follow, T.buf, want, T.offset);
+        if (n <= 0) break;
+        T.offset += n;
+        streamConsume(T.buf, n);
+    } while (T.offset < size && streamElapsed(&start) < budget);
+
+    E.eolAtEof = 0;
+    if (E.numrows > 1 && !E.row[E.numrows - 1].size) {
+        erowList *with = (erowList *) allocZero(ALLOC_ROWS, sizeof(erowList));
+        editorRowsFree(editorRowsReplace(E.numrows - 1, 1, with));
+        E.eolAtEof = 1;
+    }
+    editorRowsUnlock();
+    T.behind = T.offset < size;
+
+    if (synced) {
+        for (int i = first; i < E.numrows; i++) {
+            erow *row = &E.row[i];
+            if (i == first) {
+                row->osize += row->size - firstsize;
+                if (!firstdirty) row->flags &= ~ROW_DIRTY;
+            } else {
+                row->osize = row->size;
+                row->flags &= ~ROW_DIRTY;
+            }
+        }
+        E.firstmoved = INT_MAX;
+        E.fsize = T.offset;
+        E.fmtime = *mtime;
+    }
+
+    /* the view stays at the end of the file unless the cursor was moved away from the last row */
+    if (pinned) {
+        E.cy = E.numrows - 1;
+        E.cx = E.rx = E.max_rx = 0;
+    } else if (E.cy >= E.numrows) {
+        E.cy = E.numrows - 1;
+        E.cx = 0;
+    }
+}
+
+/* Checks the file every FOLLOW_POLL_MS, right away while the end of the file was not reached */
+static int followPending(int *fd, int *timeout) {
+    (void) fd;
+    *timeout = T.behind ? 0 : FOLLOW_POLL_MS;
+    return T.follow != -1;
+}
+
+/*
+ * Description:
+ * Checks the followed file and brings the buffer up to date with it
+ * A file that shrank or was replaced by another one at the same path is loaded again
+ * Returns 1 when the buffer changed
+ */
+static int followStep(long budget) {
+    if (T.follow == -1) return 0;
+
+    struct stat st;
+    if (stat(E.filename, &st) == -1) {
+        /* rotated away and not created again yet, the old content stays until it is */
+        T.behind = 0;
+        return 0;
+    }
+
+    /* the file is what the buffer was loaded from or saved to */
+    if (st.st_size == E.fsize && st.st_mtim.tv_sec == E.fmtime.tv_sec && st.st_mtim.tv_nsec == E.fmtime.tv_nsec) {
+        if (st.st_dev != T.dev || st.st_ino != T.ino) {
+            followStop();
+            if (!followStart()) editorSetMessage("Can not follow %s", E.filename);
+        }
+        T.offset = st.st_size;
+        T.behind = 0;
+        return 0;
+    }
+
+    if (st.st_dev != T.dev || st.st_ino != T.ino || st.st_size < T.offset) {
+        followReopen();
+        return 1;
+    }
+    if (st.st_size == T.offset) {
+        T.behind = 0;
+        return 0;
+    }
+
+    T.target = st.st_size;
+    followAppend(st.st_size, &st.st_mtim, budget);
+    return 1;
+}
+
+static int followProgress(void) {
+    if (!T.behind || !T.target) return -1;
+    return (int) (T.offset * 1000 / T.target);
+}
+
+const IdleTask followTask = {"follow", followPending, followStep, followProgress};
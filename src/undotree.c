@@ -0,0 +1,120 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <time.h>
+#include "lib.h"
+#include "alloc.h"
+#include "types.h"
+#include "editor.h"
+#include "stack.h"
+#include "undotree.h"
+
+/*** undo tree ***/
+
+/*
+ * Description:
+ * Adds a state reached from parent by act, the node takes over the data owned by act and act is left empty
+ * The new node becomes the child redo follows
+ * CAUTION: The node returned is freed along with its parent by treeDelete()
+ */
+UndoNode* treeAdd(UndoNode *parent, Action *act, long seq) {
+    UndoNode *node = (UndoNode *) allocZero(ALLOC_HISTORY, sizeof(UndoNode));
+
+    node->action = *act;
+    *act = (Action) {.length = 0, .data = NULL, .sub = NULL};
+    node->seq = seq;
+    node->time = time(NULL);
+
+    if (parent) {
+        node->parent = parent;
+        node->depth = parent->depth + 1;
+        node->next = parent->child;
+        parent->child = node;
+        parent->redo = node;
+    }
+    return node;
+}
+
+void checkpointDelete(Checkpoint *cp) {
+    if (!cp) return;
+    editorRowsFree(cp->rows);
+    allocFree(cp);
+}
+
+static void nodeFree(UndoNode *node) {
+    actionFlush(&node->action);
+    checkpointDelete(node->checkpoint);
+    allocFree(node);
+}
+
+/*
+ * Description:
+ * Unlinks node from its parent and frees it with all of its descendants
+ * Returns the number of nodes freed
+ */
+size_t treeDelete(UndoNode *node) {
+    UndoNode *parent = node->parent;
+    if (parent) {
+        UndoNode **link = &parent->child;
+        while (*link != node) link = &(*link)->next;
+        *link = node->next;
+        if (parent->redo == node) parent->redo = parent->child;
+    }
+
+    /* post-order without recursion, a long chain of edits would otherwise overflow the stack */
+    size_t count = 0;
+    UndoNode *n = node;
+    while (1) {
+        while (n->child) n = n->child;
+
+        UndoNode *up = n->parent, *next = n->next;
+        int last = n == node;
+        nodeFree(n);
+        count++;
+        if (last) break;
+
+        if (next) {
+            n = next;
+        } else {
+            up->child = NULL;
+            n = up;
+        }
+    }
+    return count;
+}
+
+/*
+ * Description:
+ * Returns the node after node in a pre-order walk of the tree under root, NULL after the last one
+ */
+UndoNode* treeNext(UndoNode *node, const UndoNode *root) {
+    if (node->child) return node->child;
+    while (node != root) {
+        if (node->next) return node->next;
+        node = node->parent;
+    }
+    return NULL;
+}
+
+/*
+ * Description:
+ * Frees the checkpoints of every node under root, they only shorten long jumps and are taken again later
+ */
+void treeDropCheckpoints(UndoNode *root) {
+    for (UndoNode *node = root; node; node = treeNext(node, root)) {
+        checkpointDelete(node->checkpoint);
+        node->checkpoint = NULL;
+    }
+}
+
+UndoNode* treeCommonAncestor(UndoNode *a, UndoNode *b) {
+    while (a->depth > b->depth) a = a->parent;
+    while (b->depth > a->depth) b = b->parent;
+    while (a != b) {
+        a = a->parent;
+        b = b->parent;
+    }
+    return a;
+}
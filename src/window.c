@@ -0,0 +1,362 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "window.h"
+
+#define RESIZE_INTERVAL_NS 16000000 /* least time between two relayouts while the terminal keeps being resized */
+
+/*** windows ***/
+/*
+ * Every window is a view over the same rows and history, with its own cursor, offsets and screen rectangle
+ * The active window's view lives in E, all the others are parked in their editorWindow
+ */
+struct editorWindow {
+    int cx, cy, rx, max_rx;
+    int rowoff, rowsub, coloff;
+    int top, left, rows, cols;
+    int prevrowoff, prevrowsub, prevcoloff, prevwelcome;
+};
+
+/* windows are the leaves of a tree of splits, that is laid out over the text area */
+typedef struct Split {
+    int vertical; /* children side by side, otherwise stacked */
+    struct Split *parent, *first, *second;
+    int win; /* index in W.wins for a leaf, -1 otherwise */
+    int top, left, rows, cols;
+} Split;
+
+static struct {
+    struct editorWindow *wins;
+    Split **leaves; /* leaf of each window */
+    int count;
+    int active;
+    Split *root;
+    int separatorsDrawn;
+} W = {NULL, NULL, 0, 0, NULL, 0};
+
+static void splitLayout(Split *sp, int top, int left, int rows, int cols) {
+    sp->top = top;
+    sp->left = left;
+    sp->rows = rows;
+    sp->cols = cols;
+
+    if (sp->win >= 0) {
+        struct editorWindow *w = &W.wins[sp->win];
+        w->top = top;
+        w->left = left;
+        w->rows = rows;
+        w->cols = cols;
+        w->prevrowoff = -1;
+        return;
+    }
+
+    /* one row/column between the children is taken by the separator */
+    if (sp->vertical) {
+        int half = (cols - 1) / 2;
+        splitLayout(sp->first, top, left, rows, half);
+        splitLayout(sp->second, top, left + half + 1, rows, cols - half - 1);
+    } else {
+        int half = (rows - 1) / 2;
+        splitLayout(sp->first, top, left, half, cols);
+        splitLayout(sp->second, top + half + 1, left, rows - half - 1, cols);
+    }
+}
+
+/*
+ * Description:
+ * Lays windows out over the text area (E.termrows - 2 rows), every window is fully repainted on the next frame
+ */
+void windowLayout(void) {
+    windowStore(W.active);
+    splitLayout(W.root, 0, 0, E.termrows - 2, E.termcols);
+    windowLoad(W.active);
+    W.separatorsDrawn = 0;
+}
+
+static Split *splitCreate(int win) {
+    Split *sp = (Split *) allocMem(ALLOC_WINDOW, sizeof(Split));
+    *sp = (Split) {0, NULL, NULL, NULL, win, 0, 0, 0, 0};
+    return sp;
+}
+
+void windowInit(void) {
+    W.wins = (struct editorWindow *) allocMem(ALLOC_WINDOW, sizeof(struct editorWindow));
+    W.leaves = (Split **) allocMem(ALLOC_WINDOW, sizeof(Split *));
+
+    W.count = 1;
+    W.active = 0;
+    W.root = W.leaves[0] = splitCreate(0);
+    windowStore(0);
+    windowLayout();
+}
+
+/*
+ * Description:
+ * Splits active window in two halves showing the same position, the new half becomes active
+ * Returns 0 when active window is too small to be split
+ */
+int windowSplit(int vertical) {
+    struct editorWindow *cur = &W.wins[W.active];
+    if (vertical ? cur->cols < 21 : cur->rows < 5) return 0;
+
+    W.wins = (struct editorWindow *) allocResize(ALLOC_WINDOW, W.wins, sizeof(struct editorWindow) * (W.count + 1));
+    W.leaves = (Split **) allocResize(ALLOC_WINDOW, W.leaves, sizeof(Split *) * (W.count + 1));
+
+    windowStore(W.active);
+    int nw = W.count++;
+    W.wins[nw] = W.wins[W.active];
+
+    /* leaf of the active window turns into the split, with both windows as its children */
+    Split *sp = W.leaves[W.active];
+    Split *first = splitCreate(W.active), *second = splitCreate(nw);
+    first->parent = second->parent = sp;
+    sp->vertical = vertical;
+    sp->first = first;
+    sp->second = second;
+    sp->win = -1;
+    W.leaves[W.active] = first;
+    W.leaves[nw] = second;
+
+    W.active = nw;
+    windowLayout();
+    return 1;
+}
+
+/*
+ * Description:
+ * Closes active window, its sibling takes over the space
+ * Returns 0 when it is the only window
+ */
+int windowClose(void) {
+    if (W.count == 1) return 0;
+
+    int closing = W.active;
+    Split *leaf = W.leaves[closing];
+    Split *parent = leaf->parent;
+    Split *sibling = parent->first == leaf ? parent->second : parent->first;
+
+    /* parent takes the sibling's place */
+    *parent = (Split) {sibling->vertical, parent->parent, sibling->first, sibling->second, sibling->win,
+                       parent->top, parent->left, parent->rows, parent->cols};
+    if (parent->win >= 0) W.leaves[parent->win] = parent;
+    else parent->first->parent = parent->second->parent = parent;
+    allocFree(sibling);
+    allocFree(leaf);
+
+    /* last window moves into the freed slot */
+    W.count--;
+    if (closing != W.count) {
+        W.wins[closing] = W.wins[W.count];
+        W.leaves[closing] = W.leaves[W.count];
+        W.leaves[closing]->win = closing;
+    }
+
+    /* focus moves to the window that took over the space */
+    Split *next = parent;
+    while (next->win < 0) next = next->first;
+    W.active = next->win;
+    windowLoad(W.active);
+    windowLayout();
+    return 1;
+}
+
+void windowNext(void) {
+    windowStore(W.active);
+    W.active = (W.active + 1) % W.count;
+    windowLoad(W.active);
+}
+
+int windowCount(void) {
+    return W.count;
+}
+
+int windowActive(void) {
+    return W.active;
+}
+
+/*
+ * Description:
+ * Makes window i's view current in E
+ * The cursor is clamped, as rows might have been removed through another window
+ */
+void windowLoad(int i) {
+    const struct editorWindow *w = &W.wins[i];
+    E.cx = w->cx;
+    E.cy = w->cy;
+    E.rx = w->rx;
+    E.max_rx = w->max_rx;
+    E.rowoff = w->rowoff;
+    E.rowsub = w->rowsub;
+    E.coloff = w->coloff;
+    E.screentop = w->top;
+    E.screenleft = w->left;
+    E.screenrows = w->rows;
+    E.screencols = w->cols;
+    E.prevrowoff = w->prevrowoff;
+    E.prevrowsub = w->prevrowsub;
+    E.prevcoloff = w->prevcoloff;
+    E.prevwelcome = w->prevwelcome;
+
+    if (E.numrows && E.cy >= E.numrows) E.cy = E.numrows - 1;
+    if (E.rowoff >= E.numrows) {
+        E.rowoff = E.numrows ? E.numrows - 1 : 0;
+        E.rowsub = 0;
+    }
+    if (E.numrows && E.cx > (int) E.row[E.cy].size) {
+        E.cx = E.row[E.cy].size;
+        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    }
+}
+
+void windowStore(int i) {
+    struct editorWindow *w = &W.wins[i];
+    w->cx = E.cx;
+    w->cy = E.cy;
+    w->rx = E.rx;
+    w->max_rx = E.max_rx;
+    w->rowoff = E.rowoff;
+    w->rowsub = E.rowsub;
+    w->coloff = E.coloff;
+    w->prevrowoff = E.prevrowoff;
+    w->prevrowsub = E.prevrowsub;
+    w->prevcoloff = E.prevcoloff;
+    w->prevwelcome = E.prevwelcome;
+}
+
+static void splitDrawSeparators(struct abuf *ab, const Split *sp) {
+    if (sp->win >= 0) return;
+
+    char pos[16];
+    int poslen;
+    if (sp->vertical) {
+        int col = sp->first->left + sp->first->cols;
+        for (int y = 0; y < sp->rows; y++) {
+            poslen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", sp->top + y + 1, col + 1);
+            abAppend(ab, pos, poslen);
+            abAppend(ab, "|", 1);
+        }
+    } else {
+        poslen = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", sp->first->top + sp->first->rows + 1, sp->left + 1);
+        abAppend(ab, pos, poslen);
+        abAppend(ab, "\x1b[7m", 4);
+        for (int x = 0; x < sp->cols; x++)
+            abAppend(ab, " ", 1);
+        abAppend(ab, "\x1b[m", 3);
+    }
+
+    splitDrawSeparators(ab, sp->first);
+    splitDrawSeparators(ab, sp->second);
+}
+
+/*
+ * Description:
+ * Draws the borders between windows, only once after every layout change
+ */
+void windowDrawSeparators(struct abuf *ab) {
+    if (W.separatorsDrawn) return;
+    splitDrawSeparators(ab, W.root);
+    W.separatorsDrawn = 1;
+}
+
+/*** resize ***/
+/*
+ * SIGWINCH only writes a byte to a pipe, the resize task reads it back on the main thread
+ * A burst of signals, like while a pane border is dragged, is coalesced into one relayout per RESIZE_INTERVAL_NS,
+ * the last size is always laid out
+ */
+static struct {
+    int pipe[2];
+    int pending;             /* a signal came after the last relayout */
+    struct timespec applied; /* time of the last relayout */
+} R = {.pipe = {-1, -1}, .pending = 0};
+
+static void resizeSignal(int sig) {
+    (void) sig;
+    int saved = errno;
+    char b = 0;
+    if (write(R.pipe[1], &b, 1) == -1) {} /* a full pipe has a relayout coming already */
+    errno = saved;
+}
+
+void windowResizeInit(void) {
+    if (pipe(R.pipe) == -1) die("In function: %s\r\nAt line: %d\r\npipe", __func__, __LINE__);
+    for (int i = 0; i < 2; i++) {
+        fcntl(R.pipe[i], F_SETFL, fcntl(R.pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(R.pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = resizeSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) die("In function: %s\r\nAt line: %d\r\nsigaction", __func__, __LINE__);
+}
+
+/* Always waits on the pipe, so a resize is seen while the editor is idle too */
+static int resizePending(int *fd, int *timeout) {
+    *fd = R.pipe[0];
+    *timeout = R.pending ? RESIZE_INTERVAL_NS / 1000000 : -1;
+    return R.pipe[0] != -1;
+}
+
+/*
+ * Description:
+ * Lays the windows out again for the new terminal size, the rows are only redrawn, caches that depend on
+ * the width, like soft-wrap breakpoints, are recomputed as the rows are drawn
+ */
+static int resizeStep(long budget) {
+    (void) budget;
+    char buf[64];
+    while (read(R.pipe[0], buf, sizeof(buf)) > 0) R.pending = 1;
+    if (!R.pending) return 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long since = (now.tv_sec - R.applied.tv_sec) * 1000000000L + (now.tv_nsec - R.applied.tv_nsec);
+    if (since < RESIZE_INTERVAL_NS) return 0;
+    R.pending = 0;
+    R.applied = now;
+
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) return 0;
+    int rows = ws.ws_row < 3 ? 3 : ws.ws_row; /* one text row besides the status and message bar */
+    if (rows == E.termrows && ws.ws_col == E.termcols) return 0;
+
+    E.termrows = rows;
+    E.termcols = ws.ws_col;
+    write(STDOUT_FILENO, "\x1b[2J", 4);
+    windowLayout();
+    return 1;
+}
+
+const IdleTask resizeTask = {"resize", resizePending, resizeStep, NULL};
+
+static void splitDelete(Split *sp) {
+    if (!sp) return;
+    splitDelete(sp->first);
+    splitDelete(sp->second);
+    allocFree(sp);
+}
+
+void windowDelete(void) {
+    splitDelete(W.root);
+    allocFree(W.wins);
+    allocFree(W.leaves);
+    W.root = NULL;
+    W.wins = NULL;
+    W.leaves = NULL;
+    W.count = 0;
+}
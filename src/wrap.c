@@ -0,0 +1,128 @@
+#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include "lib.h"
+#include "alloc.h"
+#include "editor.h"
+#include "wrap.h"
+
+/*
+ * In soft-wrap mode a row is shown on as many screen lines as it needs at the width of the window
+ * A row wider than the window caches its breakpoints in row->wraps:
+ *   wraps[0] the width they were computed for, wraps[1] the number of lines,
+ *   wraps[2...] the render column each line after the first starts at
+ * The cache is dropped when the row is edited and recomputed when the width changed
+ * Positions are always relative to some row, nothing is computed for the rows above the view
+ */
+
+/* the cell after the last character holds the cursor at the end of the row */
+#define ROW_FITS(row, width) ((int) (row)->rsize < (width))
+
+/*
+ * Description:
+ * Breaks lines after the last space that fits, or at the width when a word is longer than a line
+ */
+static int *wrapCompute(const erow *row, int width) {
+    int capacity = 8;
+    int *wraps = (int *) allocMem(ALLOC_ROWS, sizeof(int) * (capacity + 2));
+    wraps[0] = width;
+    wraps[1] = 1;
+
+    const char *chars = ROW_CHARS(row);
+    int start = 0, space = -1, rx = 0;
+    for (size_t i = 0; i <= row->size; i++) {
+        int w = i < row->size && chars[i] == '\t' ? S.tabwidth - (rx % S.tabwidth) : 1;
+        while (rx + w - start > width && rx > start) {
+            int brk = space > start ? space : rx;
+            if (wraps[1] - 1 == capacity) {
+                capacity *= 2;
+                wraps = (int *) allocResize(ALLOC_ROWS, wraps, sizeof(int) * (capacity + 2));
+            }
+            wraps[1 + wraps[1]++] = brk;
+            start = brk;
+            space = -1;
+        }
+        if (i < row->size && chars[i] == ' ') space = rx + 1;
+        rx += w;
+    }
+    return wraps;
+}
+
+static const int *wrapPoints(erow *row) {
+    int width = E.screencols;
+    if (!row->wraps || row->wraps[0] != width) {
+        allocFree(row->wraps);
+        row->wraps = wrapCompute(row, width);
+    }
+    return row->wraps;
+}
+
+int wrapLines(erow *row) {
+    if (ROW_FITS(row, E.screencols)) return 1;
+    return wrapPoints(row)[1];
+}
+
+/* Returns the render column line of row starts at */
+int wrapStart(erow *row, int line) {
+    if (!line) return 0;
+    return wrapPoints(row)[line + 1];
+}
+
+/* Returns the line of row that render column rx is shown on, by binary search over the breakpoints */
+int wrapLineOf(erow *row, int rx) {
+    if (ROW_FITS(row, E.screencols)) return 0;
+    const int *wraps = wrapPoints(row);
+    int lo = 0, hi = wraps[1] - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (wraps[mid + 1] <= rx) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/*
+ * Description:
+ * Moves the screen line (*row, *line) up by n lines, stopping at the first line of the buffer
+ */
+void wrapUp(int *row, int *line, int n) {
+    while (n > 0) {
+        if (*line >= n) {
+            *line -= n;
+            return;
+        }
+        n -= *line + 1;
+        if (*row == 0) {
+            *line = 0;
+            return;
+        }
+        (*row)--;
+        *line = wrapLines(&E.row[*row]) - 1;
+    }
+}
+
+/*
+ * Description:
+ * Returns the number of screen lines from (fromrow, fromline) down to (torow, toline)
+ * Counting stops once it exceeds limit, so only rows in between that can be on screen are wrapped
+ */
+int wrapDistance(int fromrow, int fromline, int torow, int toline, int limit) {
+    if (fromrow == torow) return toline - fromline;
+
+    int d = wrapLines(&E.row[fromrow]) - fromline;
+    for (int r = fromrow + 1; r < torow; r++) {
+        if (d > limit) return d;
+        d += wrapLines(&E.row[r]);
+    }
+    return d + toline;
+}
+
+/* Returns the number of screen lines after (row, line) till the end of buffer, at most limit */
+int wrapLinesBelow(int row, int line, int limit) {
+    int d = wrapLines(&E.row[row]) - line - 1;
+    for (int r = row + 1; r < E.numrows && d < limit; r++)
+        d += wrapLines(&E.row[r]);
+    return d < limit ? d : limit;
+}